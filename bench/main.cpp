@@ -0,0 +1,503 @@
+#include "../include/NarrowPhase.hpp"
+#include "../include/PhysicsWorld.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Microbenchmarks for the phases of a physics substep on fixed-seed scenes.
+// Every scene is scaled with the object count so that its density, and with
+// it the number of objects per grid cell, stays the same from 1k to 1M.
+
+enum class Scene { GAS, PILE, DISKS };
+
+static const char *sceneName(Scene scene) {
+  switch (scene) {
+  case Scene::GAS:
+    return "uniform_gas";
+  case Scene::PILE:
+    return "settled_pile";
+  case Scene::DISKS:
+    return "disk_layer_2d";
+  }
+  return "";
+}
+
+// Last-level cache misses of the whole process, through perf_event_open.
+// The counter is inherited by threads created after it is opened, so it has
+// to exist before any PhysicsWorld starts its workers. Unavailable off
+// Linux, in most VMs and with a strict perf_event_paranoid.
+class CacheMissCounter {
+public:
+  CacheMissCounter() {
+#ifdef __linux__
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    m_fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+  }
+  ~CacheMissCounter() {
+#ifdef __linux__
+    if (m_fd >= 0) {
+      close(m_fd);
+    }
+#endif
+  }
+  CacheMissCounter(const CacheMissCounter &) = delete;
+  CacheMissCounter &operator=(const CacheMissCounter &) = delete;
+
+  bool available() const { return m_fd >= 0; }
+  uint64_t read() const {
+    uint64_t count = 0;
+#ifdef __linux__
+    if (m_fd >= 0 && ::read(m_fd, &count, sizeof(count)) != sizeof(count)) {
+      count = 0;
+    }
+#endif
+    return count;
+  }
+
+private:
+  int m_fd = -1;
+};
+
+struct BenchOptions {
+  std::vector<Scene> scenes = {Scene::GAS, Scene::PILE, Scene::DISKS};
+  std::vector<int> sizes = {1000, 10000, 100000, 1000000};
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  unsigned int seed = 1;
+  float minSeconds = 0.25f;
+  int minRepeats = 3;
+  int maxRepeats = 100;
+  bool mortonOrder = false;
+  std::string output;
+};
+
+struct PhaseResult {
+  std::string phase;
+  std::vector<double> samplesMs;
+  uint64_t pairs = 0;
+  // Per repeat; negative when the counter is unavailable.
+  double cacheMisses = -1.0;
+};
+
+struct SceneResult {
+  Scene scene;
+  int objects;
+  float worldWidth, worldHeight, worldDepth;
+  std::vector<PhaseResult> phases;
+};
+
+// Sizes the world for the scene and fills in the particles. The gas keeps
+// about one object per two cells; the disk layer does the same in 2D.
+static void setupScene(Scene scene, int count, unsigned int seed,
+                       SimulationConstants &constants,
+                       std::unique_ptr<PhysicsWorld> &world, size_t threads) {
+  constants.NUM_OBJECTS = count;
+  const float radius = constants.OBJECT_DEFAULT_RADIUS;
+  const float spacing = 1.9f * radius;
+  int pile_side = 1;
+  int pile_layers = 1;
+
+  switch (scene) {
+  case Scene::GAS: {
+    constants.USE_3D = true;
+    float side = std::cbrt(2.0f * count) * constants.CELL_SIZE_3D;
+    constants.WORLD_WIDTH = side;
+    constants.WORLD_HEIGHT = side;
+    constants.WORLD_DEPTH = side;
+    break;
+  }
+  case Scene::PILE:
+    constants.USE_3D = true;
+    pile_side = static_cast<int>(std::ceil(std::cbrt(count)));
+    pile_layers = (count + pile_side * pile_side - 1) / (pile_side * pile_side);
+    constants.WORLD_WIDTH = pile_side * spacing + radius;
+    constants.WORLD_HEIGHT = 2.0f * pile_layers * spacing;
+    constants.WORLD_DEPTH = pile_side * spacing + radius;
+    break;
+  case Scene::DISKS: {
+    constants.USE_3D = false;
+    float side = std::sqrt(2.0f * count) * constants.CELL_SIZE_2D;
+    constants.WORLD_WIDTH = side;
+    constants.WORLD_HEIGHT = side;
+    constants.WORLD_DEPTH = 0.0f;
+    break;
+  }
+  }
+
+  world = std::make_unique<PhysicsWorld>(constants, threads);
+  world->restart(seed);
+
+  // The pile starts as a jittered, slightly overlapping lattice at rest on
+  // the floor, which is what a settled heap looks like to the broadphase
+  // without having to simulate it down first.
+  if (scene == Scene::PILE) {
+    ParticleStore &particles = world->particles();
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> jitter(-0.05f * radius,
+                                                 0.05f * radius);
+    for (int i = 0; i < count; ++i) {
+      int layer = i / (pile_side * pile_side);
+      int row = (i / pile_side) % pile_side;
+      int column = i % pile_side;
+      particles.setPosition(
+          i, glm::vec3(radius + column * spacing + jitter(gen),
+                       radius + layer * spacing + jitter(gen),
+                       radius + row * spacing + jitter(gen)));
+      particles.setVelocity(i, glm::vec3(0.0f));
+    }
+  }
+}
+
+// Walks the candidate pairs the broadphase would hand to the narrow phase
+// without testing them. The checksum keeps the loops from being optimised
+// away.
+static uint64_t generatePairs(PhysicsWorld &world,
+                              const SimulationConstants &constants,
+                              std::atomic<uint64_t> &checksum) {
+  const SpatialGrid &grid = world.grid();
+  const ParticleStore &particles = world.particles();
+  std::atomic<uint64_t> pair_count = 0;
+  if (constants.BROADPHASE == Broadphase::CELL_PAIRS) {
+    const std::vector<int> &cells = grid.populatedCells();
+    world.scheduler().parallelFor(
+        0, cells.size(), 64, [&](size_t start_idx, size_t end_idx) {
+          uint64_t pairs = 0;
+          uint64_t sum = 0;
+          for (size_t c = start_idx; c < end_idx; ++c) {
+            pairs += grid.processCellPairs(
+                cells[c], constants.USE_3D,
+                [&](uint32_t i, uint32_t j) { sum += i ^ j; });
+          }
+          pair_count.fetch_add(pairs, std::memory_order_relaxed);
+          checksum.fetch_add(sum, std::memory_order_relaxed);
+        });
+  } else {
+    world.scheduler().parallelFor(
+        0, particles.size(), 128, [&](size_t start_idx, size_t end_idx) {
+          uint64_t pairs = 0;
+          uint64_t sum = 0;
+          for (size_t i = start_idx; i < end_idx; ++i) {
+            grid.processPotentialColliders(
+                particles, static_cast<uint32_t>(i), constants.USE_3D,
+                [&](uint32_t other_index) {
+                  ++pairs;
+                  sum += i ^ other_index;
+                });
+          }
+          pair_count.fetch_add(pairs, std::memory_order_relaxed);
+          checksum.fetch_add(sum, std::memory_order_relaxed);
+        });
+  }
+  return pair_count.load();
+}
+
+// Repeats fn until both the minimum repeat count and the minimum time are
+// reached, after one untimed warm-up call.
+static PhaseResult measure(const std::string &phase,
+                           const BenchOptions &options,
+                           const CacheMissCounter &cacheMisses,
+                           const std::function<uint64_t()> &fn) {
+  PhaseResult result;
+  result.phase = phase;
+  result.pairs = fn();
+  double total_ms = 0.0;
+  const uint64_t misses_start = cacheMisses.read();
+  while (static_cast<int>(result.samplesMs.size()) < options.maxRepeats &&
+         (static_cast<int>(result.samplesMs.size()) < options.minRepeats ||
+          total_ms < 1000.0 * options.minSeconds)) {
+    auto start = std::chrono::high_resolution_clock::now();
+    fn();
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::high_resolution_clock::now() - start)
+                    .count();
+    result.samplesMs.push_back(ms);
+    total_ms += ms;
+  }
+  if (cacheMisses.available()) {
+    result.cacheMisses =
+        static_cast<double>(cacheMisses.read() - misses_start) /
+        result.samplesMs.size();
+  }
+  return result;
+}
+
+static SceneResult runScene(Scene scene, int count,
+                            const SimulationConstants &base,
+                            const BenchOptions &options,
+                            const CacheMissCounter &cacheMisses,
+                            std::atomic<uint64_t> &checksum) {
+  SimulationConstants constants = base;
+  std::unique_ptr<PhysicsWorld> world;
+  setupScene(scene, count, options.seed, constants, world, options.threads);
+  if (options.mortonOrder) {
+    world->reorderParticles();
+  }
+
+  SceneResult result{scene,
+                     count,
+                     constants.WORLD_WIDTH,
+                     constants.WORLD_HEIGHT,
+                     constants.WORLD_DEPTH,
+                     {}};
+  const float SUB_DELTA_TIME =
+      constants.FIXED_DELTA_TIME / std::max(constants.PHYSICS_ITERATIONS, 1);
+
+  result.phases.push_back(measure("grid_rebuild", options, cacheMisses, [&] {
+    world->rebuildGrid();
+    return uint64_t(0);
+  }));
+  result.phases.push_back(
+      measure("broadphase_pairs", options, cacheMisses, [&] {
+        return generatePairs(*world, constants, checksum);
+      }));
+  // Contact resolution on the grid built above: the same pair walk plus
+  // the overlap tests and responses, so the difference to broadphase_pairs
+  // is the narrow phase itself.
+  result.phases.push_back(measure("narrow_phase", options, cacheMisses, [&] {
+    return world->resolveContacts();
+  }));
+  result.phases.push_back(measure("full_substep", options, cacheMisses, [&] {
+    world->integrateAndRebuildGrid(SUB_DELTA_TIME);
+    return world->resolveContacts();
+  }));
+  return result;
+}
+
+static double median(std::vector<double> samples) {
+  if (samples.empty()) {
+    return 0.0;
+  }
+  std::sort(samples.begin(), samples.end());
+  size_t mid = samples.size() / 2;
+  return samples.size() % 2 ? samples[mid]
+                            : 0.5 * (samples[mid - 1] + samples[mid]);
+}
+
+static void writeJson(std::ostream &out, const SimulationConstants &constants,
+                      const BenchOptions &options,
+                      const std::vector<SceneResult> &results) {
+  out << "{\n";
+  out << "  \"config\": {\n";
+  out << "    \"threads\": " << options.threads << ",\n";
+  out << "    \"seed\": " << options.seed << ",\n";
+  out << "    \"contact_solver\": \""
+      << (constants.CONTACT_SOLVER == ContactSolver::CELL_COLORED ? "colored"
+                                                                  : "locked")
+      << "\",\n";
+  out << "    \"broadphase\": \""
+      << (constants.BROADPHASE == Broadphase::CELL_PAIRS ? "cellpairs"
+                                                         : "object")
+      << "\",\n";
+  out << "    \"morton_order\": "
+      << (options.mortonOrder ? "true" : "false") << ",\n";
+  out << "    \"incremental_grid\": "
+      << (constants.INCREMENTAL_GRID ? "true" : "false") << ",\n";
+  out << "    \"narrow_phase\": \""
+      << (constants.NARROW_PHASE == NarrowPhase::SIMD_BATCH
+              ? overlapKernelName()
+              : "Scalar")
+      << "\",\n";
+  out << "    \"object_radius\": " << constants.OBJECT_DEFAULT_RADIUS << "\n";
+  out << "  },\n";
+  out << "  \"results\": [";
+  bool first = true;
+  for (const SceneResult &scene : results) {
+    for (const PhaseResult &phase : scene.phases) {
+      const auto [min_it, max_it] =
+          std::minmax_element(phase.samplesMs.begin(), phase.samplesMs.end());
+      double mean = 0.0;
+      for (double ms : phase.samplesMs) {
+        mean += ms;
+      }
+      mean /= std::max<size_t>(phase.samplesMs.size(), 1);
+
+      out << (first ? "\n" : ",\n");
+      first = false;
+      out << "    {\"scene\": \"" << sceneName(scene.scene) << "\", "
+          << "\"objects\": " << scene.objects << ", "
+          << "\"world\": [" << scene.worldWidth << ", " << scene.worldHeight
+          << ", " << scene.worldDepth << "], "
+          << "\"phase\": \"" << phase.phase << "\", "
+          << "\"repeats\": " << phase.samplesMs.size() << ", "
+          << "\"median_ms\": " << median(phase.samplesMs) << ", "
+          << "\"mean_ms\": " << mean << ", "
+          << "\"min_ms\": " << *min_it << ", "
+          << "\"max_ms\": " << *max_it << ", "
+          << "\"pairs\": " << phase.pairs << ", "
+          << "\"cache_misses\": ";
+      if (phase.cacheMisses < 0.0) {
+        out << "null}";
+      } else {
+        out << phase.cacheMisses << "}";
+      }
+    }
+  }
+  out << "\n  ]\n}\n";
+}
+
+static void printUsage(const char *program) {
+  std::cerr
+      << "Usage: " << program << " [options]\n"
+      << "  --scenes LIST       gas,pile,disks (default all)\n"
+      << "  --sizes LIST        object counts (default 1000,...,1000000)\n"
+      << "  --threads N         worker threads (default: all cores)\n"
+      << "  --seed N            random seed for the scenes (default 1)\n"
+      << "  --min-time S        minimum seconds measured per phase\n"
+      << "  --repeats N         minimum repeats per phase (default 3)\n"
+      << "  --solver S          locked | colored (default colored)\n"
+      << "  --broadphase B      object | cellpairs (default cellpairs)\n"
+      << "  --simd              use the batched narrow phase\n"
+      << "  --incremental-grid  move only the objects that changed cell\n"
+      << "  --morton            Morton-sort the particles before measuring\n"
+      << "  --output FILE       write the JSON there instead of stdout\n";
+}
+
+static std::vector<std::string> splitList(const std::string &list) {
+  std::vector<std::string> items;
+  std::stringstream stream(list);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    if (!item.empty()) {
+      items.push_back(item);
+    }
+  }
+  return items;
+}
+
+int main(int argc, char **argv) {
+  SimulationConstants constants;
+  constants.CONTACT_SOLVER = ContactSolver::CELL_COLORED;
+  constants.BROADPHASE = Broadphase::CELL_PAIRS;
+  BenchOptions options;
+
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (std::strcmp(arg, "--help") == 0) {
+      printUsage(argv[0]);
+      return 0;
+    } else if (std::strcmp(arg, "--scenes") == 0 && has_value) {
+      options.scenes.clear();
+      for (const std::string &name : splitList(argv[++i])) {
+        if (name == "gas") {
+          options.scenes.push_back(Scene::GAS);
+        } else if (name == "pile") {
+          options.scenes.push_back(Scene::PILE);
+        } else if (name == "disks") {
+          options.scenes.push_back(Scene::DISKS);
+        } else {
+          printUsage(argv[0]);
+          return 1;
+        }
+      }
+    } else if (std::strcmp(arg, "--sizes") == 0 && has_value) {
+      options.sizes.clear();
+      for (const std::string &size : splitList(argv[++i])) {
+        options.sizes.push_back(std::atoi(size.c_str()));
+      }
+    } else if (std::strcmp(arg, "--threads") == 0 && has_value) {
+      options.threads = static_cast<size_t>(std::atoi(argv[++i]));
+    } else if (std::strcmp(arg, "--seed") == 0 && has_value) {
+      options.seed =
+          static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(arg, "--min-time") == 0 && has_value) {
+      options.minSeconds = std::strtof(argv[++i], nullptr);
+    } else if (std::strcmp(arg, "--repeats") == 0 && has_value) {
+      options.minRepeats = std::atoi(argv[++i]);
+    } else if (std::strcmp(arg, "--solver") == 0 && has_value) {
+      std::string solver = argv[++i];
+      if (solver == "locked") {
+        constants.CONTACT_SOLVER = ContactSolver::LOCKED;
+      } else if (solver == "colored") {
+        constants.CONTACT_SOLVER = ContactSolver::CELL_COLORED;
+      } else {
+        printUsage(argv[0]);
+        return 1;
+      }
+    } else if (std::strcmp(arg, "--broadphase") == 0 && has_value) {
+      std::string broadphase = argv[++i];
+      if (broadphase == "object") {
+        constants.BROADPHASE = Broadphase::OBJECT_NEIGHBOURHOOD;
+      } else if (broadphase == "cellpairs") {
+        constants.BROADPHASE = Broadphase::CELL_PAIRS;
+      } else {
+        printUsage(argv[0]);
+        return 1;
+      }
+    } else if (std::strcmp(arg, "--simd") == 0) {
+      constants.NARROW_PHASE = NarrowPhase::SIMD_BATCH;
+    } else if (std::strcmp(arg, "--incremental-grid") == 0) {
+      constants.INCREMENTAL_GRID = true;
+    } else if (std::strcmp(arg, "--morton") == 0) {
+      options.mortonOrder = true;
+    } else if (std::strcmp(arg, "--output") == 0 && has_value) {
+      options.output = argv[++i];
+    } else {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+  for (int size : options.sizes) {
+    if (size <= 0) {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+  if (options.threads == 0 || options.scenes.empty() ||
+      options.sizes.empty()) {
+    printUsage(argv[0]);
+    return 1;
+  }
+  options.maxRepeats = std::max(options.maxRepeats, options.minRepeats);
+
+  CacheMissCounter cacheMisses;
+  if (!cacheMisses.available()) {
+    std::cerr << "Cache miss counter unavailable" << std::endl;
+  }
+  std::atomic<uint64_t> checksum = 0;
+  std::vector<SceneResult> results;
+  for (Scene scene : options.scenes) {
+    for (int size : options.sizes) {
+      std::cerr << sceneName(scene) << " " << size << "..." << std::endl;
+      results.push_back(
+          runScene(scene, size, constants, options, cacheMisses, checksum));
+    }
+  }
+
+  if (options.output.empty()) {
+    writeJson(std::cout, constants, options, results);
+  } else {
+    std::ofstream file(options.output);
+    if (!file) {
+      std::cerr << "Could not open " << options.output << std::endl;
+      return 1;
+    }
+    writeJson(file, constants, options, results);
+  }
+  std::cerr << "checksum " << checksum.load() << std::endl;
+  return 0;
+}
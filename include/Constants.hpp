@@ -2,7 +2,12 @@
 
 #include <cstddef>
 
-const int RESERVE_PER_CELL = 20;
+enum class ContactSolver { LOCKED, CELL_COLORED };
+enum class Broadphase { OBJECT_NEIGHBOURHOOD, CELL_PAIRS, NEIGHBOUR_LIST };
+enum class NarrowPhase { SCALAR, SIMD_BATCH };
+enum class PhysicsDevice { CPU, GPU };
+enum class RayAccelerator { GRID, BVH };
+enum class SceneRenderer { RAYTRACER, IMPOSTORS, AUTO };
 
 struct SimulationConstants {
   bool USE_3D;
@@ -15,6 +20,10 @@ struct SimulationConstants {
   float CELL_SIZE_2D;
   float FIXED_DELTA_TIME;
   int PHYSICS_ITERATIONS;
+  bool ADAPTIVE_SUBSTEPS;
+  int MIN_SUBSTEPS;
+  int MAX_SUBSTEPS;
+  float SUBSTEP_CFL;
 
   float GRAVITY;
   float OBJECT_DEFAULT_RADIUS;
@@ -23,6 +32,26 @@ struct SimulationConstants {
   float OBJECT_MAX_VEL;
   float COEFFICIENT_OF_RESTITUTION;
   float VERTICAL_DAMPING;
+  ContactSolver CONTACT_SOLVER;
+  Broadphase BROADPHASE;
+  NarrowPhase NARROW_PHASE;
+  bool INCREMENTAL_GRID;
+  bool MORTON_REORDER;
+  int REORDER_INTERVAL;
+  float NEIGHBOUR_SKIN;
+  bool SLEEPING;
+  float SLEEP_VELOCITY;
+  float SLEEP_TIME;
+  PhysicsDevice PHYSICS_DEVICE;
+  RayAccelerator RAY_ACCELERATOR;
+  bool ANY_HIT_SHADOWS;
+  bool DYNAMIC_RESOLUTION;
+  float TARGET_FRAME_MS;
+  float RENDER_SCALE;
+  bool CHECKERBOARD_TRACING;
+  SceneRenderer SCENE_RENDERER;
+  int IMPOSTOR_OBJECT_THRESHOLD;
+  float IMPOSTOR_TRACE_MS;
 
   float CAMERA_MOVEMENT_SPEED;
   float CAMERA_MOUSE_SENSITIVITY;
@@ -32,9 +61,22 @@ struct SimulationConstants {
       : USE_3D(true), WORLD_WIDTH(1920.0f), WORLD_HEIGHT(1080.0f),
         WORLD_DEPTH(1080.0f), NUM_OBJECTS(4000), CELL_SIZE_3D(30.0f),
         CELL_SIZE_2D(20.0f), FIXED_DELTA_TIME(0.01f), PHYSICS_ITERATIONS(10),
+        ADAPTIVE_SUBSTEPS(false), MIN_SUBSTEPS(2), MAX_SUBSTEPS(20),
+        SUBSTEP_CFL(0.25f),
         GRAVITY(-980.0f), OBJECT_DEFAULT_RADIUS(10.0f),
         OBJECT_DEFAULT_MASS(25.0f), OBJECT_MIN_VEL(-500.0f),
         OBJECT_MAX_VEL(500.0f), COEFFICIENT_OF_RESTITUTION(0.95f),
-        VERTICAL_DAMPING(0.8f), CAMERA_MOVEMENT_SPEED(1500.0f),
+        VERTICAL_DAMPING(0.8f), CONTACT_SOLVER(ContactSolver::LOCKED),
+        BROADPHASE(Broadphase::OBJECT_NEIGHBOURHOOD),
+        NARROW_PHASE(NarrowPhase::SCALAR), INCREMENTAL_GRID(false),
+        MORTON_REORDER(false), REORDER_INTERVAL(100), NEIGHBOUR_SKIN(5.0f),
+        SLEEPING(false),
+        SLEEP_VELOCITY(15.0f), SLEEP_TIME(0.5f),
+        PHYSICS_DEVICE(PhysicsDevice::CPU),
+        RAY_ACCELERATOR(RayAccelerator::GRID), ANY_HIT_SHADOWS(true),
+        DYNAMIC_RESOLUTION(true), TARGET_FRAME_MS(16.6f), RENDER_SCALE(1.0f),
+        CHECKERBOARD_TRACING(false), SCENE_RENDERER(SceneRenderer::AUTO),
+        IMPOSTOR_OBJECT_THRESHOLD(100000), IMPOSTOR_TRACE_MS(50.0f),
+        CAMERA_MOVEMENT_SPEED(1500.0f),
         CAMERA_MOUSE_SENSITIVITY(0.1f), CAMERA_FOV(45.0f) {}
 };
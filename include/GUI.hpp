@@ -16,6 +16,10 @@ public:
   void shutdown();
 
 private:
+  void renderProfiler();
+
   bool m_firstTime = true;
   bool m_showCameraControlsWindow = false;
+  int m_profilerFrame = 0;
+  std::string m_traceStatus;
 };
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Constants.hpp"
+#include "Shader.hpp"
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <glm/glm.hpp>
+#include <memory>
+
+// Linear BVH over the object buffer at binding 1, rebuilt on the GPU every
+// frame and read by raytracer.comp from binding 11.
+//
+// Object centres get 30-bit Morton codes within the world bounds, a
+// bitonic sort orders them, each internal node then finds its key range
+// and split on its own (Karras 2012) and the boxes are merged bottom-up.
+// Nothing comes back to the CPU, so the build cost does not depend on
+// which physics backend is active.
+class GpuBvh {
+public:
+  // Matches the std430 BvhNode layout in the shaders.
+  struct Node {
+    glm::vec3 boundsMin;
+    int left;
+    glm::vec3 boundsMax;
+    int right;
+  };
+
+  GpuBvh();
+  ~GpuBvh();
+
+  GpuBvh(const GpuBvh &) = delete;
+  GpuBvh &operator=(const GpuBvh &) = delete;
+
+  bool isReady() const;
+
+  // Builds over the first numObjects objects at binding 1 and binds the
+  // nodes.
+  void build(size_t numObjects, const SimulationConstants &constants);
+
+  GLuint nodeBuffer() const { return m_nodeBuffer; }
+
+private:
+  void reserve(size_t numObjects);
+
+  std::unique_ptr<Shader> m_mortonShader;
+  std::unique_ptr<Shader> m_sortShader;
+  std::unique_ptr<Shader> m_hierarchyShader;
+  std::unique_ptr<Shader> m_refitShader;
+
+  GLuint m_nodeBuffer = 0;
+  GLuint m_keyBuffer = 0;
+  GLuint m_objectBuffer = 0;
+  GLuint m_parentBuffer = 0;
+  GLuint m_flagBuffer = 0;
+  size_t m_capacity = 0;
+};
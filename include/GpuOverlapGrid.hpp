@@ -0,0 +1,65 @@
+#pragma once
+
+#include "Constants.hpp"
+#include "Shader.hpp"
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <memory>
+
+// The raytracer's grid, built on the GPU from the object buffer at binding
+// 1. Every object is listed in each cell its bounding box overlaps, so a
+// ray walking the cells finds an object from any cell it pokes into. The
+// cell table ends up at binding 3 and the index list at binding 4, in the
+// layout raytracer.comp reads.
+//
+// Three passes with the same count, scan and scatter shape as the CPU
+// grids: atomic per-cell counts, a prefix scan into the cell table, and a
+// scatter that counts the cells back down to zero for the next build.
+class GpuOverlapGrid {
+public:
+  // Matches the std430 GpuGridCell layout read by raytracer.comp.
+  struct Cell {
+    uint32_t objectStartIndex;
+    uint32_t objectCount;
+  };
+
+  GpuOverlapGrid();
+  ~GpuOverlapGrid();
+
+  GpuOverlapGrid(const GpuOverlapGrid &) = delete;
+  GpuOverlapGrid &operator=(const GpuOverlapGrid &) = delete;
+
+  bool isReady() const;
+
+  // Builds the grid over the first numObjects objects at binding 1, none of
+  // them larger than maxRadius, and binds the result.
+  void build(size_t numObjects, float maxRadius,
+             const SimulationConstants &constants);
+
+  glm::ivec3 dimensions() const { return m_dimensions; }
+  float cellSize() const { return m_cellSize; }
+  size_t cellCount() const {
+    return static_cast<size_t>(m_dimensions.x) * m_dimensions.y *
+           m_dimensions.z;
+  }
+  size_t indexCapacity() const { return m_indexCapacity; }
+
+  GLuint cellBuffer() const { return m_cellBuffer; }
+  GLuint indexBuffer() const { return m_indexBuffer; }
+
+private:
+  std::unique_ptr<Shader> m_countShader;
+  std::unique_ptr<Shader> m_scanShader;
+  std::unique_ptr<Shader> m_scatterShader;
+
+  GLuint m_cellBuffer = 0;
+  GLuint m_cellCountBuffer = 0;
+  GLuint m_indexBuffer = 0;
+  glm::ivec3 m_dimensions = glm::ivec3(0);
+  float m_cellSize = 1.0f;
+  size_t m_indexCapacity = 0;
+};
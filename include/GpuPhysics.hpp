@@ -0,0 +1,77 @@
+#pragma once
+
+#include "Constants.hpp"
+#include "GpuTimer.hpp"
+#include "ParticleStore.hpp"
+#include "PhysicsBackend.hpp"
+#include "Shader.hpp"
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <glm/glm.hpp>
+#include <memory>
+
+// std430 layout of one object as the raytracer and the physics shaders read
+// it from binding 1.
+struct GpuPhysicsObject {
+  glm::vec3 position;
+  float radius;
+  glm::vec3 color;
+  float reflectivity;
+};
+
+// Runs the substep loop in compute shaders on buffers that stay on the GPU.
+//
+// Objects live in the raytracer's layout, so while this backend is active
+// the renderer reads the physics buffer directly; velocities and inverse
+// masses sit in a second buffer. Each substep integrates the objects and
+// counts them into a centre-cell grid, scans the counts, scatters the
+// indices and then resolves contacts one cell colour at a time, the same
+// order as the CELL_COLORED solver with the CELL_PAIRS broadphase. Particle
+// data only crosses the bus in upload() and download().
+class GpuPhysics : public PhysicsBackend {
+public:
+  explicit GpuPhysics(const SimulationConstants &constants);
+  ~GpuPhysics() override;
+
+  GpuPhysics(const GpuPhysics &) = delete;
+  GpuPhysics &operator=(const GpuPhysics &) = delete;
+
+  // False if one of the compute shaders failed to build.
+  bool isReady() const;
+
+  void upload(const ParticleStore &particles);
+  // Blocks until the GPU has finished the queued substeps.
+  void download(ParticleStore &particles) const;
+
+  void step() override;
+  const PhysicsStats &stats() const override { return m_stats; }
+
+  size_t objectCount() const { return m_objectCount; }
+  GLuint objectBuffer() const { return m_objectBuffer; }
+
+private:
+  void resizeGrid();
+  void bindBuffers() const;
+  void substep(float dt);
+
+  const SimulationConstants &m_constants;
+  std::unique_ptr<Shader> m_integrateShader;
+  std::unique_ptr<Shader> m_scanShader;
+  std::unique_ptr<Shader> m_scatterShader;
+  std::unique_ptr<Shader> m_collideShader;
+
+  GLuint m_objectBuffer = 0;
+  GLuint m_velocityBuffer = 0;
+  GLuint m_cellCountBuffer = 0;
+  GLuint m_cellStartBuffer = 0;
+  GLuint m_objectCellBuffer = 0;
+  GLuint m_sortedIndexBuffer = 0;
+  size_t m_objectCount = 0;
+  glm::ivec3 m_gridCells = glm::ivec3(0);
+  float m_cellSize = 0.0f;
+
+  GpuTimer m_timer;
+  PhysicsStats m_stats;
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <GL/glew.h>
+
+// Measures GPU time between begin() and end() with timestamp queries. A
+// result is collected once the GPU has got that far, a few frames later,
+// so reading it never stalls the CPU; frames that find every query still
+// in flight go unmeasured.
+class GpuTimer {
+public:
+  static constexpr int LATENCY = 4;
+
+  GpuTimer();
+  ~GpuTimer();
+
+  GpuTimer(const GpuTimer &) = delete;
+  GpuTimer &operator=(const GpuTimer &) = delete;
+
+  void begin();
+  void end();
+
+  // The most recent completed measurement.
+  float lastMs() const { return m_lastMs; }
+
+private:
+  void collect();
+
+  GLuint m_queries[LATENCY][2] = {};
+  bool m_pending[LATENCY] = {};
+  int m_next = 0;
+  bool m_active = false;
+  float m_lastMs = 0.0f;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Shader.hpp"
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <glm/glm.hpp>
+#include <memory>
+
+// Rasterised stand-in for the raytracer at object counts where tracing every
+// pixel costs too much. Each object is one instanced quad facing the camera
+// and covering the sphere; the fragment shader intersects the view ray with
+// the sphere, so depth and normals are per pixel, and lights it like the
+// raytracer's direct light but without shadows or reflections. Objects are
+// read from binding 1 and lights from binding 2, the raytracer's buffers.
+// The floor and the world bounds are drawn as plain geometry.
+class ImpostorRenderer {
+public:
+  ImpostorRenderer();
+  ~ImpostorRenderer();
+
+  ImpostorRenderer(const ImpostorRenderer &) = delete;
+  ImpostorRenderer &operator=(const ImpostorRenderer &) = delete;
+
+  bool isReady() const;
+
+  // Draws into the bound framebuffer and viewport, which need a depth
+  // attachment. boundsMin and boundsMax are the box the raytracer outlines.
+  void render(size_t numObjects, size_t numLights, const glm::mat4 &view,
+              const glm::mat4 &projection, const glm::vec3 &cameraPos,
+              const glm::vec3 &boundsMin, const glm::vec3 &boundsMax);
+
+private:
+  std::unique_ptr<Shader> m_objectShader;
+  std::unique_ptr<Shader> m_floorShader;
+  std::unique_ptr<Shader> m_lineShader;
+
+  // The impostor quads are built from gl_VertexID, but core profiles still
+  // want a vertex array bound.
+  GLuint m_objectVao = 0;
+  GLuint m_floorVao = 0;
+  GLuint m_floorVbo = 0;
+  GLuint m_lineVao = 0;
+  GLuint m_lineVbo = 0;
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "ParticleStore.hpp"
+#include "SpatialGrid.hpp"
+#include "TaskScheduler.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Sorts the particles along a Z-order curve over the grid cells, so that
+// objects that are close in space, and so are visited together by the
+// broadphase, are also close in memory. The sort is a parallel LSD radix
+// sort of the cells' Morton keys, eight bits per pass, and is stable:
+// particles in the same cell keep their relative order.
+class MortonOrder {
+public:
+  void compute(const ParticleStore &particles, const SpatialGrid &grid,
+               bool is3D, TaskScheduler &scheduler);
+
+  // order()[new index] is the old index, as ParticleStore::reorder takes it.
+  const std::vector<uint32_t> &order() const { return m_order; }
+  // remap()[old index] is the new index, for whoever holds old indices.
+  const std::vector<uint32_t> &remap() const { return m_remap; }
+
+private:
+  static constexpr int RADIX_BITS = 8;
+  static constexpr size_t RADIX = size_t(1) << RADIX_BITS;
+
+  std::vector<uint64_t> m_keys, m_sortedKeys;
+  std::vector<uint32_t> m_order, m_sortedOrder;
+  std::vector<uint32_t> m_remap;
+  // RADIX digit counts per block, then each block's first slot per digit.
+  std::vector<uint32_t> m_blockDigits;
+};
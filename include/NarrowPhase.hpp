@@ -0,0 +1,42 @@
+#pragma once
+
+#include "ParticleStore.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A packed run of candidate spheres copied out of the ParticleStore so that
+// one query sphere can be tested against many of them with vector loads.
+struct CandidateBatch {
+  std::vector<float> x, y, z, radius;
+  std::vector<uint32_t> index;
+
+  size_t size() const { return index.size(); }
+  void clear() {
+    x.clear();
+    y.clear();
+    z.clear();
+    radius.clear();
+    index.clear();
+  }
+  void push(const ParticleStore &particles, uint32_t i) {
+    x.push_back(particles.posX[i]);
+    y.push_back(particles.posY[i]);
+    z.push_back(particles.posZ[i]);
+    radius.push_back(particles.radius[i]);
+    index.push_back(i);
+  }
+};
+
+// Tests the query sphere against batch entries [begin, batch.size()) and
+// writes the batch position of every overlapping entry to hits, in
+// increasing order; hits must have room for batch.size() - begin entries.
+// Returns the number written.
+using OverlapKernel = size_t (*)(float qx, float qy, float qz, float qr,
+                                 const CandidateBatch &batch, size_t begin,
+                                 uint32_t *hits);
+
+// Best kernel for the running CPU (AVX-512, AVX2 or scalar), chosen once.
+OverlapKernel overlapKernel();
+const char *overlapKernelName();
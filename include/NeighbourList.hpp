@@ -0,0 +1,60 @@
+#pragma once
+
+#include "ParticleStore.hpp"
+#include "SpatialGrid.hpp"
+#include "TaskScheduler.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+struct NeighbourPair {
+  uint32_t i, j;
+};
+
+// Verlet list: every pair closer than their radii plus a skin, found once on
+// the grid and reused across substeps until some object has moved more than
+// half the skin since, before which no other pair can come into contact.
+// Pairs are grouped by the grid cell that owns them, in the order of the
+// cells handed to build(), so a range of cells that the grid solver could
+// resolve concurrently can still be resolved concurrently from the list.
+class NeighbourList {
+public:
+  // Collects the pairs owned by each of `cells` in the grid, which must have
+  // been built from the current positions. The skin is shrunk where needed
+  // so that every pair within reach lies in the 27-cell stencil.
+  void build(const ParticleStore &particles, const SpatialGrid &grid,
+             const std::vector<int> &cells, float skin, bool is3D,
+             TaskScheduler &scheduler);
+  // True before the first build, after invalidate() and once an object has
+  // moved more than half the skin since the last build.
+  bool needsRebuild(const ParticleStore &particles,
+                    TaskScheduler &scheduler) const;
+  void invalidate() { m_valid = false; }
+
+  // The widest skin for which every pair within reach still lies in the
+  // 27-cell stencil, or 0 if even touching pairs can lie beyond it.
+  static float maxSkin(const ParticleStore &particles, float cellSize);
+
+  size_t cellCount() const {
+    return m_cellStart.empty() ? 0 : m_cellStart.size() - 1;
+  }
+  std::span<const NeighbourPair> cellPairs(size_t cell) const {
+    return {m_pairs.data() + m_cellStart[cell],
+            m_cellStart[cell + 1] - m_cellStart[cell]};
+  }
+  size_t pairCount() const { return m_pairs.size(); }
+  // The skin actually used by the last build.
+  float skin() const { return m_skin; }
+
+private:
+  bool m_valid = false;
+  float m_skin = 0.0f;
+  std::vector<NeighbourPair> m_pairs;
+  std::vector<uint32_t> m_cellStart;
+  // Positions at the last build.
+  std::vector<float> m_buildX, m_buildY, m_buildZ;
+  std::vector<std::vector<NeighbourPair>> m_blockPairs;
+  std::vector<uint32_t> m_blockOffsets;
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Constants.hpp"
+#include "TaskScheduler.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <mutex>
+#include <vector>
+
+// Contiguous structure-of-arrays storage for every simulated particle. Hot
+// per-step data (position, velocity, inverse mass, radius) lives in separate
+// float arrays so the integrate loop and the narrow phase stream through
+// memory; cold data such as the colour is kept apart. Asleep objects are
+// skipped by the integrator and treated as immovable by the contact solver
+// until something wakes them.
+class ParticleStore {
+public:
+  ParticleStore() = default;
+  // Copies the particle data; the copy gets locks of its own.
+  ParticleStore(const ParticleStore &other);
+  ParticleStore &operator=(const ParticleStore &other);
+
+  void clear();
+  void resize(size_t count);
+  void spawnRandom(const SimulationConstants &constants, int count, bool is3D,
+                   float objectRadius, float objectMass, unsigned int seed);
+  // Moves particle order[i] to index i, for a permutation of all indices.
+  void reorder(const std::vector<uint32_t> &order, TaskScheduler &scheduler);
+
+  size_t size() const { return posX.size(); }
+  bool empty() const { return posX.empty(); }
+
+  glm::vec3 position(size_t i) const {
+    return glm::vec3(posX[i], posY[i], posZ[i]);
+  }
+  glm::vec3 velocity(size_t i) const {
+    return glm::vec3(velX[i], velY[i], velZ[i]);
+  }
+  float mass(size_t i) const { return 1.0f / invMass[i]; }
+
+  void setPosition(size_t i, const glm::vec3 &pos) {
+    posX[i] = pos.x;
+    posY[i] = pos.y;
+    posZ[i] = pos.z;
+  }
+  void setVelocity(size_t i, const glm::vec3 &vel) {
+    velX[i] = vel.x;
+    velY[i] = vel.y;
+    velZ[i] = vel.z;
+  }
+
+  std::mutex &lock(size_t i) const { return m_locks[i]; }
+
+  // The locked contact solver wakes objects while other threads read their
+  // flags, so both go through atomic accesses.
+  bool isAsleep(size_t i) const {
+    return std::atomic_ref<char>(const_cast<char &>(asleep[i]))
+        .load(std::memory_order_relaxed);
+  }
+  void wake(size_t i) {
+    if (isAsleep(i)) {
+      std::atomic_ref<char>(asleep[i]).store(0, std::memory_order_relaxed);
+      restTime[i] = 0.0f;
+    }
+  }
+
+  std::vector<float> posX, posY, posZ;
+  std::vector<float> velX, velY, velZ;
+  std::vector<float> invMass;
+  std::vector<float> radius;
+  std::vector<glm::vec3> color;
+  // Seconds the object has been slower than SLEEP_VELOCITY.
+  std::vector<float> restTime;
+  std::vector<char> asleep;
+
+private:
+  mutable std::vector<std::mutex> m_locks;
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct PhysicsStats {
+  float stepMs = 0.0f;
+  // Candidate pairs handed to the narrow phase per substep.
+  uint64_t pairTests = 0;
+  // Substeps the last step was split into.
+  int substeps = 0;
+  // Substeps of the last step that rebuilt the neighbour list.
+  int listRebuilds = 0;
+  // Whether the last step used the neighbour list; it falls back to cell
+  // pairs when the cells are too narrow to leave any skin.
+  bool neighbourList = false;
+  // Objects not asleep after the step; all of them with sleeping off.
+  size_t awakeObjects = 0;
+};
+
+// Something that can advance the simulation by one frame. The CPU world and
+// the GPU compute backend both implement it, so the frame loop does not
+// care where the physics runs.
+class PhysicsBackend {
+public:
+  virtual ~PhysicsBackend() = default;
+
+  // Advances one FIXED_DELTA_TIME frame split into PHYSICS_ITERATIONS
+  // substeps, or on the CPU into as many as ADAPTIVE_SUBSTEPS asks for.
+  virtual void step() = 0;
+  virtual const PhysicsStats &stats() const = 0;
+};
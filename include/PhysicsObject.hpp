@@ -1,37 +1,50 @@
 #pragma once
 
 #include "Constants.hpp"
+#include "ParticleStore.hpp"
 
+#include <cstdint>
 #include <glm/glm.hpp>
-#include <mutex>
 
+// Lightweight handle onto one particle of a ParticleStore. It keeps the old
+// per-object accessor API for callers such as the GUI; the hot loops work on
+// the store's arrays directly.
 class PhysicsObject {
 public:
-  PhysicsObject(const SimulationConstants &constants, bool is3D, float radius,
-                float mass);
-
-  void update(float dt);
-  void preventBorderCollision(bool is3D);
-
-  const glm::vec3 &position() const { return m_pos; }
-  const glm::vec3 &velocity() const { return m_vel; }
-  float radius() const { return m_rad; }
-  float mass() const { return m_mass; }
-  const glm::vec3 &color() const { return m_color; }
-
-  void updatePos(const glm::vec3 &delta) { m_pos += delta; }
-  void updateVel(const glm::vec3 &newVel) { m_vel = newVel; }
-
-  mutable std::mutex m_mutex;
+  PhysicsObject(ParticleStore &store, size_t index)
+      : m_store(&store), m_index(index) {}
+
+  void update(float dt, const SimulationConstants &constants);
+  void preventBorderCollision(const SimulationConstants &constants,
+                              bool is3D);
+
+  glm::vec3 position() const { return m_store->position(m_index); }
+  glm::vec3 velocity() const { return m_store->velocity(m_index); }
+  float radius() const { return m_store->radius[m_index]; }
+  float mass() const { return m_store->mass(m_index); }
+  const glm::vec3 &color() const { return m_store->color[m_index]; }
+  size_t index() const { return m_index; }
+
+  void updatePos(const glm::vec3 &delta) {
+    m_store->setPosition(m_index, position() + delta);
+  }
+  void updateVel(const glm::vec3 &newVel) {
+    m_store->setVelocity(m_index, newVel);
+  }
 
 private:
-  glm::vec3 m_pos;
-  glm::vec3 m_vel;
-  glm::vec3 m_color;
-  float m_rad;
-  float m_mass;
-  const SimulationConstants &m_constants;
+  ParticleStore *m_store;
+  size_t m_index;
 };
 
-void collision(PhysicsObject &o1, PhysicsObject &o2,
+void integrate(ParticleStore &store, size_t start_idx, size_t end_idx,
+               float dt, const SimulationConstants &constants);
+void preventBorderCollision(ParticleStore &store, size_t i,
+                            const SimulationConstants &constants, bool is3D);
+
+void collision(ParticleStore &store, uint32_t i, uint32_t j,
                const SimulationConstants &constants);
+// Same as collision() but without taking the per-particle locks. Only safe
+// when the caller guarantees no other thread touches i or j concurrently.
+void collisionUnlocked(ParticleStore &store, uint32_t i, uint32_t j,
+                       const SimulationConstants &constants);
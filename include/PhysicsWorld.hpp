@@ -0,0 +1,122 @@
+#pragma once
+
+#include "Constants.hpp"
+#include "MortonOrder.hpp"
+#include "NeighbourList.hpp"
+#include "ParticleStore.hpp"
+#include "PhysicsBackend.hpp"
+#include "PhysicsObject.hpp"
+#include "SpatialGrid.hpp"
+#include "TaskScheduler.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// The physics core: particles, spatial grid and the substep loop. It has no
+// window or OpenGL dependency so it can run headless, in benchmarks and
+// behind the interactive Simulation alike.
+class PhysicsWorld : public PhysicsBackend {
+public:
+  PhysicsWorld(const SimulationConstants &constants, size_t threads);
+
+  // Respawns NUM_OBJECTS particles at random; the seeded overload gives the
+  // same scene every run.
+  void restart();
+  void restart(unsigned int seed);
+  // Recreates the grid after the world dimensions or cell size changed.
+  void resizeWorld();
+
+  void step() override;
+  // Returns the candidate pairs tested.
+  uint64_t substep(float dt);
+  // PHYSICS_ITERATIONS, or with ADAPTIVE_SUBSTEPS enough substeps that the
+  // fastest object moves at most SUBSTEP_CFL times the smallest radius (or
+  // cell size) per substep, clamped to [MIN_SUBSTEPS, MAX_SUBSTEPS].
+  int substepCount();
+
+  // The phases of a substep, exposed separately for benchmarking. With the
+  // neighbour list broadphase the grid is only rebuilt along with the list,
+  // which resolveContacts() does when the list has gone stale. With
+  // INCREMENTAL_GRID only the objects that changed cell are moved.
+  void integrateAndRebuildGrid(float dt);
+  void integrateParticles(float dt);
+  void rebuildGrid();
+  uint64_t resolveContacts();
+  // Advances the rest timers by dt and puts islands of touching objects to
+  // sleep or wakes them. Does nothing but wake everything while SLEEPING is
+  // off.
+  void updateSleep(float dt);
+  // Recounts the awake objects in the stats, for when the sleep flags were
+  // set from outside.
+  void countAwake();
+  // True with the neighbour list broadphase, unless the largest objects fill
+  // the cells so that no skin is left, in which case cell pairs are used.
+  bool usesNeighbourList() const;
+  // Sorts the particle storage by the Morton key of each object's cell, as
+  // step() does every REORDER_INTERVAL frames with MORTON_REORDER. Object
+  // indices taken before go stale; reorderRemap() maps them to the new
+  // ones and reorderCount() tells when that is needed.
+  void reorderParticles();
+  const std::vector<uint32_t> &reorderRemap() const {
+    return m_mortonOrder.remap();
+  }
+  uint64_t reorderCount() const { return m_reorderCount; }
+
+  size_t objectCount() const { return m_particles.size(); }
+  PhysicsObject object(size_t index) {
+    return PhysicsObject(m_particles, index);
+  }
+
+  ParticleStore &particles() { return m_particles; }
+  const ParticleStore &particles() const { return m_particles; }
+  const SpatialGrid &grid() const { return m_grid; }
+  TaskScheduler &scheduler() { return *m_scheduler; }
+  const PhysicsStats &stats() const override { return m_stats; }
+  float cellSize() const;
+
+private:
+  void buildNeighbourList();
+  uint64_t resolveListContacts();
+
+  using CollisionResolver = void (*)(ParticleStore &, uint32_t, uint32_t,
+                                     const SimulationConstants &);
+  static uint64_t
+  checkCollisionsForChunk(ParticleStore &particles, SpatialGrid &grid,
+                          size_t start_idx, size_t end_idx,
+                          const SimulationConstants &constants);
+  static uint64_t
+  checkCollisionsForCells(ParticleStore &particles, SpatialGrid &grid,
+                          const std::vector<int> &cells, size_t start_idx,
+                          size_t end_idx,
+                          const SimulationConstants &constants);
+  static uint64_t checkCollisionsForCellPairs(
+      ParticleStore &particles, SpatialGrid &grid,
+      const std::vector<int> &cells, size_t start_idx, size_t end_idx,
+      const SimulationConstants &constants, CollisionResolver resolve);
+  static uint64_t checkCollisionsForCellBatches(
+      ParticleStore &particles, SpatialGrid &grid,
+      const std::vector<int> &cells, size_t start_idx, size_t end_idx,
+      const SimulationConstants &constants, CollisionResolver resolve);
+
+  const SimulationConstants &m_constants;
+  ParticleStore m_particles;
+  SpatialGrid m_grid;
+  std::unique_ptr<TaskScheduler> m_scheduler;
+  PhysicsStats m_stats;
+  NeighbourList m_neighbourList;
+  // The cells the list was built over, one colour after another for the
+  // cell-coloured solver, with m_listColorStart marking where each begins.
+  std::vector<int> m_listCells;
+  std::vector<size_t> m_listColorStart;
+  ContactSolver m_listSolver = ContactSolver::LOCKED;
+  float m_listSkin = 0.0f;
+  int m_listRebuilds = 0;
+  MortonOrder m_mortonOrder;
+  int m_framesSinceReorder = 0;
+  uint64_t m_reorderCount = 0;
+  // Union-find forest over the objects, rebuilt by every updateSleep().
+  std::vector<uint32_t> m_islandParent;
+  std::vector<char> m_islandRestless;
+};
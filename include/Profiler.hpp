@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct ProfileZone {
+  // Zone names must outlive the profiler, in practice string literals.
+  const char *name;
+  uint64_t startNs;
+  uint64_t endNs;
+  uint32_t thread;
+  uint32_t depth;
+};
+
+struct ProfileFrame {
+  uint64_t startNs;
+  uint64_t endNs;
+};
+
+// Collects timed zones from every thread into per-thread ring buffers.
+//
+// A thread only ever writes its own buffer, so recording takes no lock. The
+// buffers are read on the main thread between parallel phases, when the
+// scheduler's workers are idle; the parallelFor latch orders their writes
+// before the read. Once a buffer is full the oldest zones are overwritten.
+class Profiler {
+public:
+  static constexpr size_t ZONES_PER_THREAD = 1 << 16;
+  static constexpr size_t FRAME_HISTORY = 240;
+
+  static Profiler &get();
+  static uint64_t now();
+
+  void setEnabled(bool enabled);
+  bool isEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+  // Names the calling thread in the GUI and in exported traces.
+  void setThreadName(const std::string &name);
+
+  // Ends the previous frame and starts the next one. Main thread only; while
+  // the profiler is disabled the frame history is left as it is.
+  void markFrame();
+
+  void record(const char *name, uint64_t startNs, uint64_t endNs,
+              uint32_t depth);
+
+  // Completed frames, oldest first.
+  std::vector<ProfileFrame> frames() const;
+  // Zones of every thread that overlap [fromNs, toNs].
+  std::vector<ProfileZone> zones(uint64_t fromNs, uint64_t toNs) const;
+  std::vector<std::string> threadNames() const;
+  bool writeChromeTrace(const std::string &path) const;
+
+private:
+  struct ThreadBuffer {
+    std::string name;
+    uint32_t id;
+    std::vector<ProfileZone> zones;
+    uint64_t head = 0;
+  };
+
+  ThreadBuffer &localBuffer();
+
+  std::atomic<bool> m_enabled = false;
+  mutable std::mutex m_threadsMutex;
+  std::vector<std::unique_ptr<ThreadBuffer>> m_threads;
+  std::vector<ProfileFrame> m_frames;
+  size_t m_frameCount = 0;
+  uint64_t m_frameStart = 0;
+};
+
+// Records the enclosing scope as a zone while the profiler is enabled.
+class ProfileScope {
+public:
+  explicit ProfileScope(const char *name)
+      : m_name(name), m_active(Profiler::get().isEnabled()) {
+    if (m_active) {
+      m_depth = s_depth++;
+      m_start = Profiler::now();
+    }
+  }
+  ~ProfileScope() {
+    if (m_active) {
+      uint64_t end = Profiler::now();
+      --s_depth;
+      Profiler::get().record(m_name, m_start, end, m_depth);
+    }
+  }
+
+  ProfileScope(const ProfileScope &) = delete;
+  ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+  static thread_local uint32_t s_depth;
+
+  const char *m_name;
+  bool m_active;
+  uint32_t m_depth = 0;
+  uint64_t m_start = 0;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name)                                                    \
+  ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
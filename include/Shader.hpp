@@ -2,32 +2,66 @@
 
 #include <GL/glew.h>
 #include <fstream>
+#include <functional>
 #include <glm/glm.hpp>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 enum class ShaderType {
     VERTEX_FRAGMENT,
     COMPUTE_SHADER
 };
 
+// Linked programs are kept in SHADER_CACHE_DIR as driver binaries, keyed by
+// a hash of the sources and the driver strings, so later runs skip the
+// compile. A binary the driver rejects is rebuilt from source and replaced.
+// Uniform locations are looked up once after linking; the set* methods only
+// search that table.
 class Shader {
 public:
+  static constexpr const char *SHADER_CACHE_DIR = "shader_cache";
+
   GLuint ID;
 
   Shader(const char *vertexPath, const char *fragmentPath);
   Shader(const char *shaderPath, ShaderType type);
 
   void use();
-  void setBool(const std::string &name, bool value) const;
-  void setInt(const std::string &name, int value) const;
-  void setFloat(const std::string &name, float value) const;
-  void setVec2(const std::string &name, const glm::vec2 &value) const;
-  void setVec3(const std::string &name, const glm::vec3 &value) const;
-  void setMat4(const std::string &name, const glm::mat4 &mat) const;
-  void setIVec2(const std::string &name, const glm::ivec2 &value) const;
+  void setBool(std::string_view name, bool value) const;
+  void setInt(std::string_view name, int value) const;
+  void setFloat(std::string_view name, float value) const;
+  void setVec2(std::string_view name, const glm::vec2 &value) const;
+  void setVec3(std::string_view name, const glm::vec3 &value) const;
+  void setMat4(std::string_view name, const glm::mat4 &mat) const;
+  void setIVec2(std::string_view name, const glm::ivec2 &value) const;
+  void setIVec3(std::string_view name, const glm::ivec3 &value) const;
+
+  // True when the program came from the binary cache rather than a compile.
+  bool isFromCache() const { return m_fromCache; }
 
 private:
+  struct NameHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view name) const {
+      return std::hash<std::string_view>{}(name);
+    }
+  };
+
+  using Stage = std::pair<GLenum, std::string>;
+
+  void build(const std::vector<Stage> &stages);
+  bool loadBinary(const std::string &path);
+  void saveBinary(const std::string &path) const;
+  void cacheUniformLocations();
+  GLint location(std::string_view name) const;
   void checkCompileErrors(GLuint shader, std::string type);
+
+  std::unordered_map<std::string, GLint, NameHash, std::equal_to<>>
+      m_uniformLocations;
+  bool m_fromCache = false;
 };
@@ -3,94 +3,42 @@
 #include "Camera.hpp"
 #include "Constants.hpp"
 #include "GUI.hpp"
-#include "PhysicsObject.hpp"
+#include "GpuBvh.hpp"
+#include "GpuOverlapGrid.hpp"
+#include "GpuPhysics.hpp"
+#include "GpuTimer.hpp"
+#include "ImpostorRenderer.hpp"
+#include "PhysicsWorld.hpp"
 #include "Shader.hpp"
-#include "SpatialGrid.hpp"
+#include "StreamBuffer.hpp"
 #include "Window.hpp"
 
 #include <cstddef>
-#include <functional>
-#include <future>
+#include <cstdint>
 #include <glm/glm.hpp>
 #include <memory>
-#include <queue>
-#include <stdexcept>
 #include <thread>
 #include <vector>
 
-class ThreadPool {
-public:
-  ThreadPool(size_t threads) : stop(false) {
-    if (threads == 0) {
-      threads = 1;
-    }
-    for (size_t i = 0; i < threads; ++i) {
-      workers.emplace_back([this] {
-        for (;;) {
-          std::function<void()> task;
-          {
-            std::unique_lock<std::mutex> lock(this->queue_mutex);
-            this->condition.wait(
-                lock, [this] { return this->stop || !this->tasks.empty(); });
-            if (this->stop && this->tasks.empty())
-              return;
-            task = std::move(this->tasks.front());
-            this->tasks.pop();
-          }
-          task();
-        }
-      });
-    }
-  }
-
-  template <class F, class... Args>
-  auto enqueue(F &&f, Args &&...args)
-      -> std::future<typename std::result_of<F(Args...)>::type> {
-    using return_type = typename std::result_of<F(Args...)>::type;
-
-    auto task = std::make_shared<std::packaged_task<return_type()>>(
-        std::bind(std::forward<F>(f), std::forward<Args>(args)...));
-
-    std::future<return_type> res = task->get_future();
-    {
-      std::unique_lock<std::mutex> lock(queue_mutex);
-      if (stop)
-        throw std::runtime_error("enqueue on stopped ThreadPool");
-      tasks.emplace([task]() { (*task)(); });
-    }
-    condition.notify_one();
-    return res;
-  }
-
-  size_t getNumThreads() const { return workers.size(); }
-
-  ~ThreadPool() {
-    {
-      std::unique_lock<std::mutex> lock(queue_mutex);
-      stop = true;
-    }
-    condition.notify_all();
-    for (std::thread &worker : workers)
-      worker.join();
-  }
-
-private:
-  std::vector<std::thread> workers;
-  std::queue<std::function<void()>> tasks;
-  std::mutex queue_mutex;
-  std::condition_variable condition;
-  bool stop;
-};
-
 struct PointLight {
   glm::vec3 position;
   glm::vec3 color;
   float intensity;
 };
 
-struct GpuGridCell {
-  unsigned int objectStartIndex;
-  unsigned int objectCount;
+// Result of running one frame from the same state on both physics backends.
+struct BackendComparison {
+  bool valid = false;
+  size_t objects = 0;
+  float maxPositionError = 0.0f;
+  float rmsPositionError = 0.0f;
+  double cpuKineticEnergy = 0.0;
+  double gpuKineticEnergy = 0.0;
+  float cpuMs = 0.0f;
+  float gpuMs = 0.0f;
+  // The largest rms position error at which the backends still agree.
+  float tolerance = 0.0f;
+  bool withinTolerance = false;
 };
 
 class Simulation {
@@ -105,38 +53,75 @@ public:
 
   void notifyWorldDimensionsChanged();
 
+  size_t objectCount() const;
+  // The CPU copy, which is not kept up to date while the GPU runs physics.
+  PhysicsObject object(size_t index) { return m_world.object(index); }
+
 private:
   friend class GUI;
 
   Camera m_camera;
   Window m_window;
-  std::vector<std::unique_ptr<PhysicsObject>> m_objects;
-  SpatialGrid m_grid;
+  PhysicsWorld m_world;
+  // Created the first time the GPU backend is selected.
+  std::unique_ptr<GpuPhysics> m_gpuPhysics;
+  PhysicsDevice m_activeDevice = PhysicsDevice::CPU;
+  BackendComparison m_backendComparison;
+  std::unique_ptr<GpuOverlapGrid> m_overlapGrid;
+  std::unique_ptr<GpuBvh> m_bvh;
+  std::unique_ptr<GpuTimer> m_accelTimer;
+  std::unique_ptr<GpuTimer> m_raytraceTimer;
+  float m_maxObjectRadius = 0.0f;
+  // Fraction of the Scene view size the raytracer renders at.
+  float m_renderScale = 1.0f;
+
+  // Checkerboard tracing traces into one of these and reprojects the
+  // untraced half from the other; they swap every frame.
+  std::unique_ptr<Shader> m_temporalResolveShader;
+  GLuint m_historyTextures[2] = {};
+  uint64_t m_frameIndex = 0;
+  bool m_historyValid = false;
+  glm::mat4 m_prevViewProjection = glm::mat4(1.0f);
+  glm::vec3 m_prevCameraPos = glm::vec3(0.0f);
+  glm::ivec2 m_prevRenderSize = glm::ivec2(0);
+
+  std::unique_ptr<ImpostorRenderer> m_impostorRenderer;
+  bool m_drawImpostors = false;
+  // AUTO's own choice, kept while another mode is forced; the object count
+  // it switched to impostors at, and how many frames in a row the trace
+  // has run over IMPOSTOR_TRACE_MS.
+  bool m_autoImpostors = false;
+  size_t m_impostorSwitchCount = 0;
+  int m_slowTraceFrames = 0;
   GUI m_gui;
   glm::ivec2 m_debugPixel = glm::ivec2(960, 540);
   bool m_worldDimensionsChanged = false;
 
   bool m_pendingRestart = false;     // New flag
   bool m_pendingWorldResize = false; // New flag
+  bool m_pendingCrossCheck = false;
 
   Shader *m_raytracingComputeShader;
   std::vector<PointLight> m_pointLights;
 
-  static void checkCollisionsForChunk(
-      const std::vector<std::unique_ptr<PhysicsObject>> &objects,
-      SpatialGrid &grid, size_t start_idx, size_t end_idx,
-      const SimulationConstants &constants);
   GLuint m_fbo;
   GLuint m_fboTexture;
   GLuint m_rbo;
   int m_currentDisplayW;
   int m_currentDisplayH;
-  GLuint m_objectSSBO;
   GLuint m_lightSSBO;
-  GLuint m_gridCellsSSBO;
-  GLuint m_objectIndicesSSBO;
-
-  std::unique_ptr<ThreadPool> m_threadPool;
+  // Uniform block 0 of raytracer.comp and temporal_resolve.comp.
+  GLuint m_frameUniformBuffer = 0;
+  StreamBuffer m_objectStream;
 
   void resizeGpuBuffers();
+  void resizeHistoryTextures();
+  void updateRenderScale();
+  void updateScenePath();
+
+  PhysicsBackend &physics();
+  const PhysicsStats &physicsStats() const;
+  bool createGpuPhysics();
+  void syncPhysicsDevice();
+  void crossCheckBackends();
 };
@@ -1,21 +1,191 @@
 #pragma once
 
 #include "Constants.hpp"
-#include "PhysicsObject.hpp"
+#include "ParticleStore.hpp"
+#include "TaskScheduler.hpp"
 
-#include <memory>
+#include <cstdint>
+#include <span>
+#include <utility>
 #include <vector>
 
+// Uniform grid stored in compressed sparse row form: particle indices are
+// counting-sorted by cell into one array, and m_cellStart[c] ..
+// m_cellEnd[c] is the contiguous range belonging to cell c. Rebuilds can
+// leave free slots between m_cellEnd[c] and m_cellStart[c + 1] so that
+// update() has room to move particles into the cell.
 class SpatialGrid {
 public:
+  // Free slots per cell that PhysicsWorld reserves for incremental updates.
+  static constexpr uint32_t UPDATE_SLACK = 2;
+
   SpatialGrid(float width, float height, float depth, float cellSize);
-  void insert(const std::unique_ptr<PhysicsObject> &object, bool is3D);
+  void rebuild(const ParticleStore &particles, bool is3D,
+               TaskScheduler &scheduler);
+  // Free slots later rebuilds leave after every cell.
+  void setUpdateSlack(uint32_t slack) { m_updateSlack = slack; }
+
+  // rebuild() split into its phases so the binning pass can be fused into
+  // another parallel loop over the particles: call beginRebuild(), then
+  // binObjects() over disjoint ranges covering every particle, then
+  // finishRebuild() once all of them have returned.
+  void beginRebuild(size_t numObjects);
+  void binObjects(const ParticleStore &particles, bool is3D, size_t start_idx,
+                  size_t end_idx);
+  void finishRebuild(TaskScheduler &scheduler);
+
+  // Incremental alternative to rebuild() for a grid already built for the
+  // same number of particles. Only the particles whose cell changed are
+  // moved: each block of particles batches its moves by the range of cells
+  // they leave and enter, and every cell range is then patched by a single
+  // thread, so no locks are needed. A cell that runs out of free slots has
+  // its block of cells laid out again within the block's slots. Falls back
+  // to a rebuild when a whole block is full or so many particles moved that
+  // sorting is cheaper.
+  void update(const ParticleStore &particles, bool is3D,
+              TaskScheduler &scheduler);
+
+  // update() split into its phases like rebuild(). If beginUpdate() returns
+  // false the grid needs a rebuild instead; otherwise call findMoves() once
+  // for every block below updateBlockCount(), after the particles in
+  // updateBlock(block) have reached their new positions, and then
+  // finishUpdate().
+  bool beginUpdate(size_t numObjects, TaskScheduler &scheduler);
+  size_t updateBlockCount() const { return m_numObjectBlocks; }
+  std::pair<size_t, size_t> updateBlock(size_t block) const {
+    return {block * m_objectCell.size() / m_numObjectBlocks,
+            (block + 1) * m_objectCell.size() / m_numObjectBlocks};
+  }
+  void findMoves(const ParticleStore &particles, bool is3D, size_t block);
+  void finishUpdate(const ParticleStore &particles, bool is3D,
+                    TaskScheduler &scheduler);
+
+  template <typename TCallback>
+  void processPotentialColliders(const ParticleStore &particles,
+                                 uint32_t index, bool is3D,
+                                 TCallback callback) const {
+    processNeighbourhood(getCellCoords(particles.position(index)), is3D,
+                         callback);
+  }
+
+  // Like processPotentialColliders, but around the cell itself rather than
+  // an object's current position, which contacts may already have moved
+  // out of it. A solver that owns the cell then never reaches further.
+  template <typename TCallback>
+  void processCellNeighbourhood(int cell, bool is3D,
+                                TCallback callback) const {
+    processNeighbourhood(getCellCoords(cell), is3D, callback);
+  }
 
+  // Visits every candidate pair owned by one cell: the intra-cell triangle
+  // plus all pairs with the forward half of the neighbour stencil (13 cells
+  // in 3D, 4 in 2D). Summed over all cells each pair comes up exactly once.
   template <typename TCallback>
-  void processPotentialColliders(const std::unique_ptr<PhysicsObject> &object,
-                                 bool is3D, TCallback callback) {
-    glm::ivec3 centerCoords = getCellCoords(object->position());
+  uint64_t processCellPairs(int cell, bool is3D, TCallback callback) const {
+    std::span<const uint32_t> own = cellObjects(cell);
+    uint64_t pairs = 0;
+    for (size_t a = 0; a < own.size(); ++a) {
+      for (size_t b = a + 1; b < own.size(); ++b) {
+        callback(own[a], own[b]);
+      }
+    }
+    pairs += own.size() * (own.size() - 1) / 2;
+
+    forEachForwardNeighbour(cell, is3D, [&](std::span<const uint32_t> other) {
+      for (uint32_t i : own) {
+        for (uint32_t j : other) {
+          callback(i, j);
+        }
+      }
+      pairs += own.size() * other.size();
+    });
+    return pairs;
+  }
+
+  // Calls callback(objects) for each valid cell of the forward half stencil.
+  template <typename TCallback>
+  void forEachForwardNeighbour(int cell, bool is3D,
+                               TCallback callback) const {
+    glm::ivec3 coords = getCellCoords(cell);
+    const int num_offsets = is3D ? 13 : 4;
+    for (int n = 0; n < num_offsets; ++n) {
+      glm::ivec3 neighborCoords = {coords.x + HALF_STENCIL[n][0],
+                                   coords.y + HALF_STENCIL[n][1],
+                                   coords.z + HALF_STENCIL[n][2]};
+      if (isValidCell(neighborCoords)) {
+        callback(cellObjects(get1DIndex(neighborCoords)));
+      }
+    }
+  }
 
+  // Whether the last rebuild binned an awake object into the cell.
+  bool isCellAwake(int cell) const {
+    return m_cellAwakeStamp[cell] == m_rebuildStamp;
+  }
+  // False if the cell and its whole forward half stencil hold only asleep
+  // objects, in which case processCellPairs(cell) has nothing to resolve.
+  bool hasAwakePairs(int cell, bool is3D) const;
+
+  // Cells whose coordinates are equal modulo 3 on every axis never share a
+  // neighbour, so all cells of one colour can be resolved concurrently.
+  static int colorCount(bool is3D) { return is3D ? 27 : 9; }
+  void buildColorBuckets(bool is3D);
+  const std::vector<int> &cellsOfColor(int color) const {
+    return m_colorCells[color];
+  }
+  std::span<const uint32_t> cellObjects(int cell) const {
+    return {m_sortedIndices.data() + m_cellStart[cell],
+            m_cellEnd[cell] - m_cellStart[cell]};
+  }
+
+  float cellSize() const { return m_cellSize; }
+  // Z-order (Morton) code of the cell holding pos, clamped into the grid,
+  // so that nearby cells mostly get nearby codes. Only the low
+  // mortonBits(is3D) bits can be set.
+  uint64_t mortonKey(const glm::vec3 &pos, bool is3D) const;
+  int mortonBits(bool is3D) const;
+  // Forces the next update() to rebuild, for when the particle indices the
+  // grid holds no longer mean the same particles.
+  void invalidate() { m_built = false; }
+  const std::vector<int> &populatedCells() const {
+    return m_dirtyCellIndices;
+  }
+  // The cell the object was last binned into, or -1 outside the grid.
+  int objectCell(uint32_t index) const { return m_objectCell[index]; }
+  // Whether the cells are at most one cell apart on every axis.
+  bool areNeighbours(int a, int b) const;
+
+  std::span<const uint32_t> getInternalCellObjects(glm::ivec3 coords) {
+    if (!isValidCell(coords)) {
+      return {};
+    }
+    return cellObjects(get1DIndex(coords));
+  }
+
+private:
+  struct Move {
+    uint32_t index;
+    int from, to;
+  };
+
+  // What each owner of a range of cells learnt while applying its moves.
+  struct CellBlock {
+    std::vector<int> newCells;
+    std::vector<int> populated;
+    std::vector<uint32_t> scratch;
+    bool populatedChanged = false;
+    bool overflow = false;
+  };
+
+  // The 2D half stencil is the first four entries; 3D adds the next z layer.
+  static constexpr int HALF_STENCIL[13][3] = {
+      {1, 0, 0},  {-1, 1, 0}, {0, 1, 0},  {1, 1, 0},  {-1, -1, 1},
+      {0, -1, 1}, {1, -1, 1}, {-1, 0, 1}, {0, 0, 1},  {1, 0, 1},
+      {-1, 1, 1}, {0, 1, 1},  {1, 1, 1}};
+
+  template <typename TCallback>
+  void processNeighbourhood(glm::ivec3 centerCoords, bool is3D,
+                            TCallback callback) const {
     int z_start = is3D ? -1 : 0;
     int z_end = is3D ? 1 : 0;
 
@@ -27,10 +197,9 @@ public:
                                        centerCoords.z + z_offset};
 
           if (isValidCell(neighborCoords)) {
-            int index = get1DIndex(neighborCoords);
-            const std::vector<PhysicsObject *> &cellObjects = m_grid[index];
-            for (PhysicsObject *other_object : cellObjects) {
-              callback(other_object);
+            int cell = get1DIndex(neighborCoords);
+            for (uint32_t k = m_cellStart[cell]; k < m_cellEnd[cell]; ++k) {
+              callback(m_sortedIndices[k]);
             }
           }
         }
@@ -38,26 +207,52 @@ public:
     }
   }
 
-  void clear();
-
-  const std::vector<PhysicsObject *> &
-  getInternalCellObjects(glm::ivec3 coords) {
-    if (!isValidCell(coords)) {
-      static const std::vector<PhysicsObject *> emptyVec;
-      return emptyVec;
-    }
-    return m_grid[get1DIndex(coords)];
+  glm::ivec3 getCellCoords(const glm::vec3 &pos) const;
+  glm::ivec3 getCellCoords(int cell) const;
+  int get1DIndex(const glm::ivec3 &coords) const;
+  bool isValidCell(const glm::ivec3 &coords) const;
+  // The cell holding pos, or -1 outside the grid.
+  int cellIndex(const glm::vec3 &pos, bool is3D) const;
+  void nextStamp();
+  void markAwake(int cell);
+  size_t cellBlockBegin(size_t block) const {
+    return block * m_cellCount.size() / m_numCellBlocks;
   }
-
-private:
-  glm::ivec3 getCellCoords(const glm::vec3 &pos);
-  int get1DIndex(const glm::ivec3 &coords);
-  bool isValidCell(const glm::ivec3 &coords);
+  size_t cellBlockOf(int cell) const {
+    return ((static_cast<uint64_t>(cell) + 1) * m_numCellBlocks - 1) /
+           m_cellCount.size();
+  }
+  void applyMoves(size_t cellBlock);
+  bool repackCellBlock(size_t cellBlock);
+  void updatePopulatedCells(TaskScheduler &scheduler);
 
   float m_cellSize;
   int m_cellsX, m_cellsY, m_cellsZ;
-  std::vector<std::vector<PhysicsObject *>> m_grid;
+  std::vector<uint32_t> m_cellStart;
+  std::vector<uint32_t> m_cellEnd;
+  std::vector<uint32_t> m_cellCount;
+  std::vector<uint32_t> m_sortedIndices;
+  std::vector<int> m_objectCell;
+  std::vector<uint32_t> m_blockOffsets;
+  std::vector<uint32_t> m_blockPopulated;
   std::vector<int> m_populatedCellIndices;
   std::vector<int> m_dirtyCellIndices;
   std::vector<char> m_isCellDirty;
+  uint32_t m_updateSlack = 0;
+  bool m_built = false;
+  // m_blockPopulated is the prefix of populated cells per block of cells,
+  // which update() keeps to patch m_dirtyCellIndices block by block.
+  size_t m_numCellBlocks = 0;
+  size_t m_numObjectBlocks = 0;
+  // Indexed by particle block * m_numCellBlocks + cell block.
+  std::vector<std::vector<Move>> m_moveBatches;
+  std::vector<uint32_t> m_blockMoves;
+  std::vector<CellBlock> m_cellBlocks;
+  std::vector<int> m_nextDirtyCellIndices;
+  std::vector<uint32_t> m_nextBlockPopulated;
+  // A cell is awake when its stamp equals the current rebuild's, which
+  // saves clearing the flags before every rebuild.
+  std::vector<uint32_t> m_cellAwakeStamp;
+  uint32_t m_rebuildStamp = 0;
+  std::vector<std::vector<int>> m_colorCells;
 };
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <cstddef>
+
+// Shader storage buffer that the CPU refills every frame.
+//
+// With ARB_buffer_storage the buffer holds REGIONS regions and is mapped
+// persistently once, so writers fill mapped memory directly. Each frame
+// writes the next region; a fence placed after the GPU commands that read a
+// region guards it until it comes round again. Without the extension every
+// write maps a freshly orphaned buffer instead. Either way the buffer grows
+// when a write needs more space than it has.
+class StreamBuffer {
+public:
+  static constexpr int REGIONS = 3;
+
+  StreamBuffer() = default;
+  ~StreamBuffer();
+
+  StreamBuffer(const StreamBuffer &) = delete;
+  StreamBuffer &operator=(const StreamBuffer &) = delete;
+
+  // Returns memory for `bytes` bytes of this frame's data, or nullptr if the
+  // buffer could not be mapped. It is write-only and must be filled before
+  // commit().
+  void *map(size_t bytes);
+  // Binds what map() handed out to the given SSBO binding point.
+  void commit(GLuint binding);
+  // Marks the region committed this frame as in use by the commands issued
+  // so far. Call once after the last draw or dispatch that reads it.
+  void fence();
+
+  bool isPersistent() const { return m_persistent; }
+  size_t capacity() const { return m_regionSize; }
+
+private:
+  void allocate(size_t bytes);
+  void release();
+
+  GLuint m_buffer = 0;
+  bool m_persistent = false;
+  char *m_mapped = nullptr;
+  size_t m_regionSize = 0;
+  size_t m_writeSize = 0;
+  int m_region = 0;
+  GLsync m_fences[REGIONS] = {};
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fork-join scheduler for the data-parallel phases of a substep.
+//
+// parallelFor() splits its range evenly over one range deque per worker.
+// Each worker takes grains from the front of its own deque, and once that
+// is empty it steals the back half of another worker's deque. The job
+// description lives on the caller's stack, so a call allocates nothing. The
+// calling thread works as worker 0 and returns once a latch says every
+// worker has finished. Between jobs the workers spin for a short while
+// before parking, so back-to-back phases do not pay a futex wake-up.
+//
+// parallelFor() is not reentrant and must only be called from one thread.
+class TaskScheduler {
+public:
+  explicit TaskScheduler(size_t threads);
+  ~TaskScheduler();
+
+  TaskScheduler(const TaskScheduler &) = delete;
+  TaskScheduler &operator=(const TaskScheduler &) = delete;
+
+  // Number of threads taking part in a parallelFor, the caller included.
+  size_t getNumThreads() const { return m_numSlots; }
+
+  // Calls fn(start, end) on disjoint sub-ranges that cover [begin, end).
+  // Each sub-range holds at most `grain` indices; a grain of 0 picks one
+  // that gives every thread about eight pieces to balance with.
+  template <typename F>
+  void parallelFor(size_t begin, size_t end, size_t grain, F &&fn) {
+    if (begin >= end) {
+      return;
+    }
+    using Fn = std::remove_reference_t<F>;
+    run(begin, end, grain,
+        [](const void *ctx, size_t start_idx, size_t end_idx) {
+          (*static_cast<Fn *>(const_cast<void *>(ctx)))(start_idx, end_idx);
+        },
+        static_cast<const void *>(std::addressof(fn)));
+  }
+
+private:
+  using Invoke = void (*)(const void *ctx, size_t start_idx, size_t end_idx);
+
+  struct Job {
+    Invoke invoke;
+    const void *ctx;
+    size_t base;
+    uint32_t grain;
+    std::atomic<uint32_t> pending;
+  };
+
+  // [begin, end) offsets from Job::base packed into one word so that the
+  // owner and thieves can both claim work with a single compare-exchange.
+  struct alignas(64) RangeDeque {
+    std::atomic<uint64_t> range{0};
+  };
+
+  void run(size_t begin, size_t end, size_t grain, Invoke invoke,
+           const void *ctx);
+  void workerLoop(size_t slot);
+  void drain(Job &job, size_t slot);
+  bool popFront(RangeDeque &deque, uint32_t grain, uint32_t &start_idx,
+                uint32_t &end_idx);
+  bool stealBack(RangeDeque &deque, uint32_t grain, uint32_t &start_idx,
+                 uint32_t &end_idx);
+
+  size_t m_numSlots;
+  int m_spinIterations;
+  std::unique_ptr<RangeDeque[]> m_deques;
+  std::vector<std::thread> m_workers;
+  Job *m_job = nullptr;
+  std::atomic<uint32_t> m_epoch{0};
+  std::atomic<bool> m_stop{false};
+};
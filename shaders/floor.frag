@@ -1,9 +1,44 @@
-#version 330 core
+#version 450
 out vec4 FragColor;
 
-uniform vec3 u_color;
+// The raytracer's checkered floor, lit without shadows and reflecting only
+// the sky.
+
+struct GpuPointLight {
+    vec3 position;
+    float intensity;
+    vec3 color;
+    float padding;
+};
+
+layout(std430, binding = 2) readonly buffer LightsBuffer {
+    GpuPointLight lights[];
+};
+
+uniform vec3 cameraPos;
+uniform int numLights;
+
+in vec3 v_worldPos;
 
 void main()
 {
-    FragColor = vec4(u_color, 1.0);
+    vec2 floorCoords = v_worldPos.xz / 200.0;
+    vec3 baseColor = int(floor(floorCoords.x) + floor(floorCoords.y)) % 2 == 0
+                         ? vec3(0.35, 0.2, 0.05)
+                         : vec3(0.7, 0.5, 0.25);
+    vec3 normal = vec3(0.0, 1.0, 0.0);
+    vec3 viewDir = normalize(cameraPos - v_worldPos);
+
+    vec3 color = baseColor * 0.15;
+    for (int i = 0; i < numLights; ++i) {
+        vec3 lightDir = normalize(lights[i].position - v_worldPos);
+        float diff = max(dot(normal, lightDir), 0.0);
+        vec3 reflectDir = reflect(-lightDir, normal);
+        float spec = diff > 0.0 ? pow(max(dot(viewDir, reflectDir), 0.0), 256.0) : 0.0;
+        float lightDistance = length(lights[i].position - v_worldPos);
+        float attenuation = 1.0 / (1.0 + 0.001 * lightDistance + 0.00001 * lightDistance * lightDistance);
+        color += (diff * baseColor + spec) * lights[i].color * lights[i].intensity * attenuation;
+    }
+    color += 0.15 * vec3(0.5, 0.7, 1.0);
+    FragColor = vec4(color, 1.0);
 }
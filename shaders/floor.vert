@@ -1,11 +1,14 @@
-#version 330 core
+#version 450
 layout (location = 0) in vec3 aPos;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+out vec3 v_worldPos;
+
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    v_worldPos = vec3(model * vec4(aPos, 1.0));
+    gl_Position = projection * view * vec4(v_worldPos, 1.0);
 }
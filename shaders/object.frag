@@ -1,18 +1,65 @@
-#version 330 core
-out vec4 FragColor;
+#version 450
+
+// Intersects the view ray with the sphere, so depth and normals are the
+// sphere's rather than the quad's. Lit like the raytracer's direct light,
+// without shadows; instead of a reflection ray, the reflection picks up the
+// sky or a roughly lit floor depending on where it points.
+
+struct GpuPointLight {
+    vec3 position;
+    float intensity;
+    vec3 color;
+    float padding;
+};
+
+layout(std430, binding = 2) readonly buffer LightsBuffer {
+    GpuPointLight lights[];
+};
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform int numLights;
 
-in vec2 v_fragCoord;
+in vec3 v_viewPos;
+flat in vec3 v_center;
+flat in float v_radius;
+flat in vec3 v_color;
+flat in float v_reflectivity;
 
-uniform vec3 u_color;
-uniform bool u_isSphere;
+out vec4 FragColor;
+
+const vec3 SKY_COLOR = vec3(0.5, 0.7, 1.0);
+const vec3 FLOOR_COLOR = vec3(0.29, 0.2, 0.08);
 
 void main()
 {
-    if (!u_isSphere) {
-        float dist = length(v_fragCoord);
-        if(dist > 0.5) {
-            discard;
-        }
+    vec3 rayDir = normalize(v_viewPos);
+    float b = dot(rayDir, v_center);
+    float c = dot(v_center, v_center) - v_radius * v_radius;
+    float discriminant = b * b - c;
+    if (discriminant < 0.0) {
+        discard;
+    }
+    vec3 position = rayDir * (b - sqrt(discriminant));
+    vec3 normal = (position - v_center) / v_radius;
+
+    vec4 clipPos = projection * vec4(position, 1.0);
+    gl_FragDepth = clipPos.z / clipPos.w * 0.5 + 0.5;
+
+    vec3 color = v_color * 0.15;
+    for (int i = 0; i < numLights; ++i) {
+        vec3 lightPos = vec3(view * vec4(lights[i].position, 1.0));
+        vec3 lightDir = normalize(lightPos - position);
+        float diff = max(dot(normal, lightDir), 0.0);
+        vec3 reflectDir = reflect(-lightDir, normal);
+        float spec = diff > 0.0 ? pow(max(dot(-rayDir, reflectDir), 0.0), 256.0) : 0.0;
+        float lightDistance = length(lightPos - position);
+        float attenuation = 1.0 / (1.0 + 0.001 * lightDistance + 0.00001 * lightDistance * lightDistance);
+        color += (diff * v_color + spec) * lights[i].color * lights[i].intensity * attenuation;
     }
-    FragColor = vec4(u_color, 1.0);
+    // mat3(view) is a rotation, so its transpose takes directions back to
+    // world space.
+    vec3 reflected = transpose(mat3(view)) * reflect(rayDir, normal);
+    color += v_reflectivity * (reflected.y > 0.0 ? SKY_COLOR : FLOOR_COLOR);
+    FragColor = vec4(color, 1.0);
 }
@@ -1,14 +1,54 @@
-#version 330 core
-layout (location = 0) in vec3 aPos;
+#version 450
+
+// One impostor quad per object, drawn as an instanced four-vertex strip.
+// The quad faces the camera across the view ray through the centre and sits
+// on the sphere's near side; with a half-size of one radius it covers the
+// sphere's outline from any point outside it.
+
+struct GpuPhysicsObject {
+    vec3 position;
+    float radius;
+    vec3 color;
+    float reflectivity;
+};
+
+layout(std430, binding = 1) readonly buffer ObjectsBuffer {
+    GpuPhysicsObject objects[];
+};
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
-out vec2 v_fragCoord;
+out vec3 v_viewPos;
+flat out vec3 v_center;
+flat out float v_radius;
+flat out vec3 v_color;
+flat out float v_reflectivity;
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
-    v_fragCoord = aPos.xy;
+    GpuPhysicsObject object = objects[gl_InstanceID];
+    vec3 center = vec3(view * vec4(object.position, 1.0));
+    float dist = length(center);
+    v_center = center;
+    v_radius = object.radius;
+    v_color = object.color;
+    v_reflectivity = object.reflectivity;
+
+    // A camera inside the sphere sees nothing of it, as in the raytracer.
+    if (dist <= object.radius) {
+        v_viewPos = vec3(0.0);
+        gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+        return;
+    }
+
+    vec3 axis = center / dist;
+    vec3 up = abs(axis.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0);
+    vec3 right = normalize(cross(up, axis));
+    up = cross(axis, right);
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+
+    v_viewPos = center - axis * object.radius +
+                (right * corner.x + up * corner.y) * object.radius;
+    gl_Position = projection * vec4(v_viewPos, 1.0);
 }
@@ -1,4 +1,6 @@
 #include "../include/GUI.hpp"
+#include "../include/NarrowPhase.hpp"
+#include "../include/Profiler.hpp"
 #include "../include/Simulation.hpp"
 
 #include "imgui.h"
@@ -6,6 +8,9 @@
 #include "imgui_impl_opengl3.h"
 #include "imgui_internal.h"
 
+#include <algorithm>
+#include <map>
+
 void GUI::init(GLFWwindow *window) {
   IMGUI_CHECKVERSION();
   ImGui::CreateContext();
@@ -61,6 +66,8 @@ void GUI::render(Simulation &sim, GLuint sceneTexture, int &display_w,
     ImGui::DockBuilderSetNodeSize(dockspace_id, viewport->Size);
 
     ImGuiID dock_main_id = dockspace_id;
+    ImGuiID dock_bottom_id = ImGui::DockBuilderSplitNode(
+        dock_main_id, ImGuiDir_Down, 0.3f, nullptr, &dock_main_id);
     ImGuiID dock_left_id = ImGui::DockBuilderSplitNode(
         dock_main_id, ImGuiDir_Left, 0.25f, nullptr, &dock_main_id);
     ImGuiID dock_left_top_id = ImGui::DockBuilderSplitNode(
@@ -70,6 +77,7 @@ void GUI::render(Simulation &sim, GLuint sceneTexture, int &display_w,
     ImGui::DockBuilderDockWindow("Settings", dock_left_top_id);
     ImGui::DockBuilderDockWindow("Camera Controls", dock_left_bottom_id);
     ImGui::DockBuilderDockWindow("Scene", dock_main_id);
+    ImGui::DockBuilderDockWindow("Profiler", dock_bottom_id);
     ImGui::DockBuilderFinish(dockspace_id);
   }
 
@@ -115,7 +123,126 @@ void GUI::render(Simulation &sim, GLuint sceneTexture, int &display_w,
   ImGui::Separator();
   ImGui::Text("Physics Engine Settings");
   ImGui::InputFloat("Fixed Delta Time", &sim.m_constants.FIXED_DELTA_TIME);
-  ImGui::InputInt("Physics Iterations", &sim.m_constants.PHYSICS_ITERATIONS);
+  ImGui::Checkbox("Adaptive Substeps", &sim.m_constants.ADAPTIVE_SUBSTEPS);
+  if (sim.m_constants.ADAPTIVE_SUBSTEPS) {
+    ImGui::InputInt("Min Substeps", &sim.m_constants.MIN_SUBSTEPS);
+    ImGui::InputInt("Max Substeps", &sim.m_constants.MAX_SUBSTEPS);
+    ImGui::SliderFloat("Max Travel / Radius", &sim.m_constants.SUBSTEP_CFL,
+                       0.05f, 1.0f, "%.2f");
+  } else {
+    ImGui::InputInt("Physics Iterations",
+                    &sim.m_constants.PHYSICS_ITERATIONS);
+  }
+  const char *contact_solvers[] = {"Locked (per-object mutex)",
+                                   "Cell colored (lock-free)"};
+  int contact_solver = static_cast<int>(sim.m_constants.CONTACT_SOLVER);
+  if (ImGui::Combo("Contact Solver", &contact_solver, contact_solvers,
+                   IM_ARRAYSIZE(contact_solvers))) {
+    sim.m_constants.CONTACT_SOLVER =
+        static_cast<ContactSolver>(contact_solver);
+  }
+  const char *broadphases[] = {"Object neighbourhood (27 cells)",
+                               "Cell pairs (half stencil)",
+                               "Neighbour list (Verlet)"};
+  int broadphase = static_cast<int>(sim.m_constants.BROADPHASE);
+  if (ImGui::Combo("Broadphase", &broadphase, broadphases,
+                   IM_ARRAYSIZE(broadphases))) {
+    sim.m_constants.BROADPHASE = static_cast<Broadphase>(broadphase);
+  }
+  if (sim.m_constants.BROADPHASE == Broadphase::NEIGHBOUR_LIST) {
+    ImGui::SliderFloat("List Skin", &sim.m_constants.NEIGHBOUR_SKIN, 0.0f,
+                       20.0f, "%.1f");
+  }
+  if (sim.m_constants.BROADPHASE == Broadphase::CELL_PAIRS) {
+    bool simd_batch =
+        sim.m_constants.NARROW_PHASE == NarrowPhase::SIMD_BATCH;
+    if (ImGui::Checkbox("Batched Narrow Phase", &simd_batch)) {
+      sim.m_constants.NARROW_PHASE =
+          simd_batch ? NarrowPhase::SIMD_BATCH : NarrowPhase::SCALAR;
+    }
+    ImGui::SameLine();
+    ImGui::Text("(%s)", overlapKernelName());
+  }
+  ImGui::Checkbox("Incremental Grid", &sim.m_constants.INCREMENTAL_GRID);
+  ImGui::Checkbox("Morton Reorder", &sim.m_constants.MORTON_REORDER);
+  if (sim.m_constants.MORTON_REORDER) {
+    ImGui::SliderInt("Reorder Every (frames)",
+                     &sim.m_constants.REORDER_INTERVAL, 1, 1000);
+  }
+  ImGui::Checkbox("Sleep Objects at Rest", &sim.m_constants.SLEEPING);
+  if (sim.m_constants.SLEEPING) {
+    ImGui::SliderFloat("Sleep Below Speed", &sim.m_constants.SLEEP_VELOCITY,
+                       1.0f, 100.0f, "%.0f");
+    ImGui::SliderFloat("Sleep After (s)", &sim.m_constants.SLEEP_TIME, 0.1f,
+                       5.0f, "%.1f");
+  }
+  const char *physics_devices[] = {"CPU (task scheduler)",
+                                   "GPU (compute shaders)"};
+  int physics_device = static_cast<int>(sim.m_constants.PHYSICS_DEVICE);
+  if (ImGui::Combo("Physics Device", &physics_device, physics_devices,
+                   IM_ARRAYSIZE(physics_devices))) {
+    sim.m_constants.PHYSICS_DEVICE =
+        static_cast<PhysicsDevice>(physics_device);
+  }
+  const bool on_gpu = sim.m_activeDevice == PhysicsDevice::GPU;
+  if (on_gpu) {
+    ImGui::TextDisabled("GPU solver: cell colored, cell pairs");
+  }
+  const PhysicsStats &stats = sim.physicsStats();
+  ImGui::Text("Physics Step: %.2f ms%s", stats.stepMs,
+              on_gpu ? " (GPU time)" : "");
+  ImGui::Text("Substeps: %d%s", stats.substeps,
+              on_gpu && sim.m_constants.ADAPTIVE_SUBSTEPS
+                  ? " (fixed on the GPU)"
+                  : "");
+  if (on_gpu) {
+    ImGui::Text("Pair Tests / Substep: not counted on the GPU");
+  } else {
+    ImGui::Text("Pair Tests / Substep: %llu",
+                static_cast<unsigned long long>(stats.pairTests));
+  }
+  if (on_gpu) {
+    ImGui::Text("Awake Objects: all (no sleeping on the GPU)");
+  } else {
+    ImGui::Text("Awake Objects: %zu / %zu", stats.awakeObjects,
+                sim.objectCount());
+  }
+  if (!on_gpu && sim.m_constants.BROADPHASE == Broadphase::NEIGHBOUR_LIST) {
+    if (stats.neighbourList) {
+      ImGui::Text("List Rebuilds: %d of %d substeps", stats.listRebuilds,
+                  stats.substeps);
+    } else {
+      ImGui::Text("Cells leave no skin; using cell pairs");
+    }
+  }
+  if (!on_gpu && sim.m_constants.BROADPHASE == Broadphase::CELL_PAIRS) {
+    // The object neighbourhood walk visits every pair from both sides and
+    // every object against itself.
+    uint64_t full_stencil = 2 * stats.pairTests + sim.objectCount();
+    float reduction =
+        full_stencil > 0
+            ? 100.0f * (1.0f - static_cast<float>(stats.pairTests) /
+                                   static_cast<float>(full_stencil))
+            : 0.0f;
+    ImGui::Text("Full Stencil Equivalent: %llu (%.0f%% fewer)",
+                static_cast<unsigned long long>(full_stencil), reduction);
+  }
+  if (ImGui::Button("Cross-Check CPU vs GPU")) {
+    sim.m_pendingCrossCheck = true;
+  }
+  const BackendComparison &comparison = sim.m_backendComparison;
+  if (comparison.valid) {
+    ImGui::Text("Position Error: max %.3f, rms %.4f (%zu objects)",
+                comparison.maxPositionError, comparison.rmsPositionError,
+                comparison.objects);
+    ImGui::Text("RMS Error: %s the tolerance of %.3f",
+                comparison.withinTolerance ? "within" : "over",
+                comparison.tolerance);
+    ImGui::Text("Kinetic Energy: CPU %.4g, GPU %.4g",
+                comparison.cpuKineticEnergy, comparison.gpuKineticEnergy);
+    ImGui::Text("Frame: CPU %.2f ms, GPU %.2f ms incl. readback",
+                comparison.cpuMs, comparison.gpuMs);
+  }
 
   ImGui::Separator();
   ImGui::Text("Default Object Properties (Restart Required)");
@@ -132,6 +259,51 @@ void GUI::render(Simulation &sim, GLuint sceneTexture, int &display_w,
   ImGui::InputFloat("Cell Size 2D", &sim.m_constants.CELL_SIZE_2D);
   ImGui::InputFloat("Cell Size 3D", &sim.m_constants.CELL_SIZE_3D);
 
+  ImGui::Separator();
+  ImGui::Text("Rendering");
+  const char *scene_renderers[] = {"Raytracer", "Impostors (raster)", "Auto"};
+  int scene_renderer = static_cast<int>(sim.m_constants.SCENE_RENDERER);
+  if (ImGui::Combo("Scene Renderer", &scene_renderer, scene_renderers,
+                   IM_ARRAYSIZE(scene_renderers))) {
+    sim.m_constants.SCENE_RENDERER =
+        static_cast<SceneRenderer>(scene_renderer);
+  }
+  if (sim.m_constants.SCENE_RENDERER == SceneRenderer::AUTO) {
+    ImGui::InputInt("Impostors From Objects",
+                    &sim.m_constants.IMPOSTOR_OBJECT_THRESHOLD, 1000, 10000);
+    ImGui::SliderFloat("Or Trace Over (ms)", &sim.m_constants.IMPOSTOR_TRACE_MS,
+                       10.0f, 200.0f, "%.0f");
+  }
+  ImGui::Text("Drawing: %s",
+              sim.m_drawImpostors ? "Impostors" : "Raytracer");
+  const char *ray_accelerators[] = {"Uniform grid (DDA)", "Linear BVH"};
+  int ray_accelerator = static_cast<int>(sim.m_constants.RAY_ACCELERATOR);
+  if (ImGui::Combo("Ray Accelerator", &ray_accelerator, ray_accelerators,
+                   IM_ARRAYSIZE(ray_accelerators))) {
+    sim.m_constants.RAY_ACCELERATOR =
+        static_cast<RayAccelerator>(ray_accelerator);
+  }
+  ImGui::Checkbox("Any-Hit Shadow Rays", &sim.m_constants.ANY_HIT_SHADOWS);
+  ImGui::Checkbox("Checkerboard Tracing",
+                  &sim.m_constants.CHECKERBOARD_TRACING);
+  ImGui::Checkbox("Dynamic Resolution", &sim.m_constants.DYNAMIC_RESOLUTION);
+  if (sim.m_constants.DYNAMIC_RESOLUTION) {
+    ImGui::SliderFloat("Target GPU Time (ms)", &sim.m_constants.TARGET_FRAME_MS,
+                       4.0f, 50.0f, "%.1f");
+  } else {
+    ImGui::SliderFloat("Render Scale", &sim.m_constants.RENDER_SCALE, 0.25f,
+                       1.0f, "%.2f");
+  }
+  ImGui::Text("Render Scale: %.0f%% (%dx%d)", sim.m_renderScale * 100.0f,
+              static_cast<int>(sim.m_currentDisplayW * sim.m_renderScale),
+              static_cast<int>(sim.m_currentDisplayH * sim.m_renderScale));
+  if (sim.m_drawImpostors) {
+    ImGui::Text("GPU Raster: %.2f ms", sim.m_raytraceTimer->lastMs());
+  } else {
+    ImGui::Text("GPU Build: %.2f ms, Trace: %.2f ms",
+                sim.m_accelTimer->lastMs(), sim.m_raytraceTimer->lastMs());
+  }
+
   ImGui::Separator();
   ImGui::Text("Camera Settings");
   ImGui::SliderFloat("Movement Speed", &sim.m_constants.CAMERA_MOVEMENT_SPEED,
@@ -143,6 +315,9 @@ void GUI::render(Simulation &sim, GLuint sceneTexture, int &display_w,
   ImGui::Separator();
   ImGui::Text("Debug Settings");
   ImGui::InputInt2("Debug Pixel (X, Y)", &sim.m_debugPixel[0]);
+  ImGui::Text("SSBO Streaming: %s",
+              sim.m_objectStream.isPersistent() ? "Persistent Mapped"
+                                                : "Mapped per Frame");
 
   ImGui::End();
 
@@ -162,15 +337,160 @@ void GUI::render(Simulation &sim, GLuint sceneTexture, int &display_w,
     ImGui::End();
   }
 
+  renderProfiler();
+
   ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0.0f, 0.0f));
   ImGui::Begin("Scene");
   ImVec2 scene_view_size = ImGui::GetContentRegionAvail();
   display_w = static_cast<int>(scene_view_size.x); // Update display_w
   display_h = static_cast<int>(scene_view_size.y); // Update display_h
+  // Only the lower-left render-scale corner of the texture is traced.
   ImGui::Image((ImTextureID)(uintptr_t)sceneTexture, scene_view_size,
-               ImVec2(0, 1), ImVec2(1, 0));
+               ImVec2(0, sim.m_renderScale), ImVec2(sim.m_renderScale, 0));
   ImGui::End();
   ImGui::PopStyleVar();
 
   ImGui::Render();
 }
+
+// Zone colours only need to be stable per name and tell neighbours apart.
+static ImU32 zoneColor(const char *name) {
+  uint32_t hash = 2166136261u;
+  for (const char *c = name; *c; ++c) {
+    hash = (hash ^ static_cast<unsigned char>(*c)) * 16777619u;
+  }
+  return IM_COL32(90 + hash % 140, 90 + (hash >> 8) % 140,
+                  90 + (hash >> 16) % 140, 255);
+}
+
+void GUI::renderProfiler() {
+  Profiler &profiler = Profiler::get();
+  ImGui::Begin("Profiler");
+
+  bool recording = profiler.isEnabled();
+  if (ImGui::Checkbox("Record", &recording)) {
+    profiler.setEnabled(recording);
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("Export Chrome Trace")) {
+    m_traceStatus = profiler.writeChromeTrace("profile_trace.json")
+                        ? "Wrote profile_trace.json"
+                        : "Could not write profile_trace.json";
+  }
+  if (!m_traceStatus.empty()) {
+    ImGui::SameLine();
+    ImGui::TextDisabled("%s", m_traceStatus.c_str());
+  }
+
+  std::vector<ProfileFrame> frames = profiler.frames();
+  if (frames.empty()) {
+    ImGui::Text("No frames recorded.");
+    ImGui::End();
+    return;
+  }
+
+  std::vector<float> frame_ms(frames.size());
+  for (size_t i = 0; i < frames.size(); ++i) {
+    frame_ms[i] = (frames[i].endNs - frames[i].startNs) / 1e6f;
+  }
+  float width = ImGui::GetContentRegionAvail().x;
+  ImGui::PlotLines("##FrameTimes", frame_ms.data(),
+                   static_cast<int>(frame_ms.size()), 0, "Frame ms", 0.0f,
+                   *std::max_element(frame_ms.begin(), frame_ms.end()),
+                   ImVec2(width, 50.0f));
+
+  // While recording the newest frame is shown; pausing allows scrubbing
+  // back through the history.
+  int last_frame = static_cast<int>(frames.size()) - 1;
+  if (recording) {
+    m_profilerFrame = last_frame;
+  } else {
+    ImGui::SliderInt("Frame", &m_profilerFrame, 0, last_frame);
+  }
+  m_profilerFrame = std::clamp(m_profilerFrame, 0, last_frame);
+  const ProfileFrame &frame = frames[m_profilerFrame];
+  const float frame_duration = static_cast<float>(frame.endNs - frame.startNs);
+  ImGui::Text("Frame %.3f ms", frame_duration / 1e6f);
+
+  std::vector<ProfileZone> zones = profiler.zones(frame.startNs, frame.endNs);
+  std::vector<std::string> thread_names = profiler.threadNames();
+  std::vector<uint32_t> lane_depth(thread_names.size(), 0);
+  for (const ProfileZone &zone : zones) {
+    lane_depth[zone.thread] = std::max(lane_depth[zone.thread], zone.depth + 1);
+  }
+
+  // One lane per thread that recorded anything this frame, with nested
+  // zones stacked below their parents.
+  ImDrawList *draw_list = ImGui::GetWindowDrawList();
+  const float row_height = ImGui::GetTextLineHeight() + 4.0f;
+  const ImVec2 mouse = ImGui::GetMousePos();
+  for (size_t t = 0; t < thread_names.size(); ++t) {
+    if (lane_depth[t] == 0) {
+      continue;
+    }
+    ImGui::TextDisabled("%s", thread_names[t].c_str());
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    float lane_height = row_height * lane_depth[t];
+    ImGui::Dummy(ImVec2(width, lane_height));
+    bool lane_hovered = ImGui::IsItemHovered();
+
+    draw_list->PushClipRect(origin,
+                            ImVec2(origin.x + width, origin.y + lane_height),
+                            true);
+    for (const ProfileZone &zone : zones) {
+      if (zone.thread != t) {
+        continue;
+      }
+      uint64_t start = std::max(zone.startNs, frame.startNs);
+      uint64_t end = std::min(zone.endNs, frame.endNs);
+      ImVec2 min(origin.x + width * (start - frame.startNs) / frame_duration,
+                 origin.y + row_height * zone.depth);
+      ImVec2 max(
+          std::max(origin.x + width * (end - frame.startNs) / frame_duration,
+                   min.x + 1.0f),
+          min.y + row_height - 1.0f);
+      draw_list->AddRectFilled(min, max, zoneColor(zone.name));
+      if (max.x - min.x > ImGui::CalcTextSize(zone.name).x + 4.0f) {
+        draw_list->AddText(ImVec2(min.x + 2.0f, min.y + 2.0f),
+                           IM_COL32(0, 0, 0, 255), zone.name);
+      }
+      if (lane_hovered && mouse.x >= min.x && mouse.x < max.x &&
+          mouse.y >= min.y && mouse.y < max.y) {
+        ImGui::SetTooltip("%s\n%.3f ms", zone.name,
+                          (zone.endNs - zone.startNs) / 1e6f);
+      }
+    }
+    draw_list->PopClipRect();
+  }
+
+  // Totals per zone name over all threads of the shown frame.
+  std::map<std::string, std::pair<double, int>> totals;
+  for (const ProfileZone &zone : zones) {
+    auto &total = totals[zone.name];
+    total.first += (zone.endNs - zone.startNs) / 1e6;
+    ++total.second;
+  }
+  std::vector<std::pair<std::string, std::pair<double, int>>> sorted(
+      totals.begin(), totals.end());
+  std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+    return a.second.first > b.second.first;
+  });
+  if (ImGui::BeginTable("ZoneTotals", 3)) {
+    ImGui::TableSetupColumn("Zone");
+    ImGui::TableSetupColumn("Total ms");
+    ImGui::TableSetupColumn("Count");
+    ImGui::TableHeadersRow();
+    for (const auto &[name, total] : sorted) {
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::Text("%s", name.c_str());
+      ImGui::TableNextColumn();
+      ImGui::Text("%.3f", total.first);
+      ImGui::TableNextColumn();
+      ImGui::Text("%d", total.second);
+    }
+    ImGui::EndTable();
+  }
+
+  ImGui::End();
+}
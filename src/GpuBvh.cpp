@@ -0,0 +1,141 @@
+#include "../include/GpuBvh.hpp"
+#include "../include/Profiler.hpp"
+
+#include <algorithm>
+#include <vector>
+
+static constexpr GLuint NODES_BINDING = 11;
+static constexpr GLuint KEYS_BINDING = 12;
+static constexpr GLuint SORTED_OBJECTS_BINDING = 13;
+static constexpr GLuint PARENTS_BINDING = 14;
+static constexpr GLuint FLAGS_BINDING = 15;
+static constexpr GLuint GROUP_SIZE = 128;
+
+static GLuint groupsFor(size_t invocations) {
+  return static_cast<GLuint>((invocations + GROUP_SIZE - 1) / GROUP_SIZE);
+}
+
+static size_t nextPowerOfTwo(size_t value) {
+  size_t power = 1;
+  while (power < value) {
+    power <<= 1;
+  }
+  return power;
+}
+
+GpuBvh::GpuBvh() {
+  m_mortonShader = std::make_unique<Shader>("shaders/bvh_morton.comp",
+                                            ShaderType::COMPUTE_SHADER);
+  m_sortShader = std::make_unique<Shader>("shaders/bvh_sort.comp",
+                                          ShaderType::COMPUTE_SHADER);
+  m_hierarchyShader = std::make_unique<Shader>("shaders/bvh_hierarchy.comp",
+                                               ShaderType::COMPUTE_SHADER);
+  m_refitShader = std::make_unique<Shader>("shaders/bvh_refit.comp",
+                                           ShaderType::COMPUTE_SHADER);
+  GLuint *buffers[] = {&m_nodeBuffer, &m_keyBuffer, &m_objectBuffer,
+                       &m_parentBuffer, &m_flagBuffer};
+  for (GLuint *buffer : buffers) {
+    glGenBuffers(1, buffer);
+  }
+}
+
+GpuBvh::~GpuBvh() {
+  GLuint buffers[] = {m_nodeBuffer, m_keyBuffer, m_objectBuffer,
+                      m_parentBuffer, m_flagBuffer};
+  glDeleteBuffers(5, buffers);
+  for (Shader *shader : {m_mortonShader.get(), m_sortShader.get(),
+                         m_hierarchyShader.get(), m_refitShader.get()}) {
+    glDeleteProgram(shader->ID);
+  }
+}
+
+bool GpuBvh::isReady() const {
+  for (Shader *shader : {m_mortonShader.get(), m_sortShader.get(),
+                         m_hierarchyShader.get(), m_refitShader.get()}) {
+    GLint linked = GL_FALSE;
+    glGetProgramiv(shader->ID, GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The refit leaves every flag at zero, so the flags only need clearing
+// when they are reallocated.
+void GpuBvh::reserve(size_t numObjects) {
+  if (numObjects <= m_capacity) {
+    return;
+  }
+  m_capacity = numObjects + numObjects / 2;
+  const size_t keys = nextPowerOfTwo(m_capacity);
+  const size_t internalNodes = m_capacity - 1;
+  std::vector<uint32_t> zeros(internalNodes, 0);
+
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_nodeBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, internalNodes * sizeof(Node),
+               nullptr, GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_keyBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, keys * sizeof(uint32_t), nullptr,
+               GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_objectBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, keys * sizeof(uint32_t), nullptr,
+               GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_parentBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER,
+               (internalNodes + m_capacity) * sizeof(int32_t), nullptr,
+               GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_flagBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, zeros.size() * sizeof(uint32_t),
+               zeros.data(), GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void GpuBvh::build(size_t numObjects, const SimulationConstants &constants) {
+  PROFILE_SCOPE("BVH Dispatch");
+  reserve(std::max<size_t>(numObjects, 2));
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NODES_BINDING, m_nodeBuffer);
+  // A single object needs no nodes; the traversal tests it directly.
+  if (numObjects < 2) {
+    return;
+  }
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, KEYS_BINDING, m_keyBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SORTED_OBJECTS_BINDING,
+                   m_objectBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PARENTS_BINDING, m_parentBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, FLAGS_BINDING, m_flagBuffer);
+
+  const int count = static_cast<int>(numObjects);
+  const int keys = static_cast<int>(nextPowerOfTwo(numObjects));
+
+  m_mortonShader->use();
+  m_mortonShader->setInt("numObjects", count);
+  m_mortonShader->setInt("numKeys", keys);
+  m_mortonShader->setVec3("boundsMin", glm::vec3(0.0f));
+  m_mortonShader->setVec3("boundsMax", glm::vec3(constants.WORLD_WIDTH,
+                                                 constants.WORLD_HEIGHT,
+                                                 constants.WORLD_DEPTH));
+  glDispatchCompute(groupsFor(keys), 1, 1);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  m_sortShader->use();
+  m_sortShader->setInt("numKeys", keys);
+  for (int k = 2; k <= keys; k <<= 1) {
+    m_sortShader->setInt("k", k);
+    for (int j = k >> 1; j > 0; j >>= 1) {
+      m_sortShader->setInt("j", j);
+      glDispatchCompute(groupsFor(keys), 1, 1);
+      glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+  }
+
+  m_hierarchyShader->use();
+  m_hierarchyShader->setInt("numObjects", count);
+  glDispatchCompute(groupsFor(numObjects - 1), 1, 1);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  m_refitShader->use();
+  m_refitShader->setInt("numObjects", count);
+  glDispatchCompute(groupsFor(numObjects), 1, 1);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
@@ -0,0 +1,117 @@
+#include "../include/GpuOverlapGrid.hpp"
+#include "../include/Profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+static constexpr GLuint CELLS_BINDING = 3;
+static constexpr GLuint INDICES_BINDING = 4;
+static constexpr GLuint CELL_COUNTS_BINDING = 10;
+static constexpr GLuint OBJECT_GROUP_SIZE = 128;
+
+GpuOverlapGrid::GpuOverlapGrid() {
+  m_countShader = std::make_unique<Shader>("shaders/grid_count.comp",
+                                           ShaderType::COMPUTE_SHADER);
+  m_scanShader = std::make_unique<Shader>("shaders/grid_scan.comp",
+                                          ShaderType::COMPUTE_SHADER);
+  m_scatterShader = std::make_unique<Shader>("shaders/grid_scatter.comp",
+                                             ShaderType::COMPUTE_SHADER);
+  glGenBuffers(1, &m_cellBuffer);
+  glGenBuffers(1, &m_cellCountBuffer);
+  glGenBuffers(1, &m_indexBuffer);
+}
+
+GpuOverlapGrid::~GpuOverlapGrid() {
+  GLuint buffers[] = {m_cellBuffer, m_cellCountBuffer, m_indexBuffer};
+  glDeleteBuffers(3, buffers);
+  for (Shader *shader :
+       {m_countShader.get(), m_scanShader.get(), m_scatterShader.get()}) {
+    glDeleteProgram(shader->ID);
+  }
+}
+
+bool GpuOverlapGrid::isReady() const {
+  for (Shader *shader :
+       {m_countShader.get(), m_scanShader.get(), m_scatterShader.get()}) {
+    GLint linked = GL_FALSE;
+    glGetProgramiv(shader->ID, GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void GpuOverlapGrid::build(size_t numObjects, float maxRadius,
+                           const SimulationConstants &constants) {
+  PROFILE_SCOPE("Overlap Grid Dispatch");
+  const bool is3D = constants.USE_3D;
+  m_cellSize = is3D ? constants.CELL_SIZE_3D : constants.CELL_SIZE_2D;
+  glm::ivec3 dimensions = glm::max(
+      glm::ivec3(glm::ceil(glm::vec3(constants.WORLD_WIDTH,
+                                     constants.WORLD_HEIGHT,
+                                     constants.WORLD_DEPTH) /
+                           m_cellSize)),
+      glm::ivec3(1));
+  // The scatter leaves the counts at zero, so they only need clearing when
+  // the grid is reallocated.
+  if (dimensions != m_dimensions) {
+    m_dimensions = dimensions;
+    std::vector<uint32_t> zeros(cellCount(), 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_cellCountBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, zeros.size() * sizeof(uint32_t),
+                 zeros.data(), GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_cellBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, cellCount() * sizeof(Cell),
+                 nullptr, GL_DYNAMIC_COPY);
+  }
+
+  // A box of extent 2r touches at most floor(2r / cellSize) + 2 cells per
+  // axis, which bounds the index list without reading the total back.
+  const size_t span =
+      static_cast<size_t>(std::floor(2.0f * maxRadius / m_cellSize)) + 2;
+  const size_t capacity =
+      std::max<size_t>(numObjects * span * span * (is3D ? span : 1), 1);
+  if (capacity > m_indexCapacity) {
+    m_indexCapacity = capacity;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_indexBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, m_indexCapacity * sizeof(uint32_t),
+                 nullptr, GL_DYNAMIC_COPY);
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CELLS_BINDING, m_cellBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INDICES_BINDING, m_indexBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CELL_COUNTS_BINDING,
+                   m_cellCountBuffer);
+  const GLuint object_groups = static_cast<GLuint>(
+      (numObjects + OBJECT_GROUP_SIZE - 1) / OBJECT_GROUP_SIZE);
+
+  if (object_groups > 0) {
+    m_countShader->use();
+    m_countShader->setInt("numObjects", static_cast<int>(numObjects));
+    m_countShader->setIVec3("gridDimensions", m_dimensions);
+    m_countShader->setFloat("cellSize", m_cellSize);
+    m_countShader->setBool("use3D", is3D);
+    glDispatchCompute(object_groups, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+  }
+
+  m_scanShader->use();
+  m_scanShader->setInt("numCells", static_cast<int>(cellCount()));
+  glDispatchCompute(1, 1, 1);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  if (object_groups > 0) {
+    m_scatterShader->use();
+    m_scatterShader->setInt("numObjects", static_cast<int>(numObjects));
+    m_scatterShader->setIVec3("gridDimensions", m_dimensions);
+    m_scatterShader->setFloat("cellSize", m_cellSize);
+    m_scatterShader->setBool("use3D", is3D);
+    m_scatterShader->setInt("indexCapacity",
+                            static_cast<int>(m_indexCapacity));
+    glDispatchCompute(object_groups, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+  }
+}
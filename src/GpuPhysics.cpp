@@ -0,0 +1,237 @@
+#include "../include/GpuPhysics.hpp"
+#include "../include/Profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// SSBO binding points shared with the physics_*.comp shaders. Binding 1 is
+// also the raytracer's object buffer.
+static constexpr GLuint OBJECTS_BINDING = 1;
+static constexpr GLuint VELOCITIES_BINDING = 5;
+static constexpr GLuint CELL_COUNTS_BINDING = 6;
+static constexpr GLuint CELL_STARTS_BINDING = 7;
+static constexpr GLuint OBJECT_CELLS_BINDING = 8;
+static constexpr GLuint SORTED_INDICES_BINDING = 9;
+
+static constexpr GLuint OBJECT_GROUP_SIZE = 128;
+static constexpr GLuint CELL_GROUP_SIZE = 64;
+
+static GLuint groupsFor(size_t invocations, GLuint groupSize) {
+  return static_cast<GLuint>((invocations + groupSize - 1) / groupSize);
+}
+
+GpuPhysics::GpuPhysics(const SimulationConstants &constants)
+    : m_constants(constants) {
+  m_integrateShader = std::make_unique<Shader>(
+      "shaders/physics_integrate.comp", ShaderType::COMPUTE_SHADER);
+  m_scanShader = std::make_unique<Shader>("shaders/physics_scan.comp",
+                                          ShaderType::COMPUTE_SHADER);
+  m_scatterShader = std::make_unique<Shader>("shaders/physics_scatter.comp",
+                                             ShaderType::COMPUTE_SHADER);
+  m_collideShader = std::make_unique<Shader>("shaders/physics_collide.comp",
+                                             ShaderType::COMPUTE_SHADER);
+
+  GLuint *buffers[] = {&m_objectBuffer,    &m_velocityBuffer,
+                       &m_cellCountBuffer, &m_cellStartBuffer,
+                       &m_objectCellBuffer, &m_sortedIndexBuffer};
+  for (GLuint *buffer : buffers) {
+    glGenBuffers(1, buffer);
+  }
+}
+
+GpuPhysics::~GpuPhysics() {
+  GLuint buffers[] = {m_objectBuffer,    m_velocityBuffer,
+                      m_cellCountBuffer, m_cellStartBuffer,
+                      m_objectCellBuffer, m_sortedIndexBuffer};
+  glDeleteBuffers(6, buffers);
+  for (Shader *shader : {m_integrateShader.get(), m_scanShader.get(),
+                         m_scatterShader.get(), m_collideShader.get()}) {
+    glDeleteProgram(shader->ID);
+  }
+}
+
+bool GpuPhysics::isReady() const {
+  for (Shader *shader : {m_integrateShader.get(), m_scanShader.get(),
+                         m_scatterShader.get(), m_collideShader.get()}) {
+    GLint linked = GL_FALSE;
+    glGetProgramiv(shader->ID, GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void GpuPhysics::upload(const ParticleStore &particles) {
+  m_objectCount = particles.size();
+  std::vector<GpuPhysicsObject> objects(m_objectCount);
+  std::vector<glm::vec4> velocities(m_objectCount);
+  for (size_t i = 0; i < m_objectCount; ++i) {
+    objects[i] = {particles.position(i), particles.radius[i],
+                  particles.color[i], 0.75f};
+    velocities[i] = glm::vec4(particles.velocity(i), particles.invMass[i]);
+  }
+
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_objectBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER,
+               objects.size() * sizeof(GpuPhysicsObject), objects.data(),
+               GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_velocityBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER,
+               velocities.size() * sizeof(glm::vec4), velocities.data(),
+               GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_objectCellBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, m_objectCount * sizeof(glm::uvec2),
+               nullptr, GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_sortedIndexBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, m_objectCount * sizeof(uint32_t),
+               nullptr, GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void GpuPhysics::download(ParticleStore &particles) const {
+  std::vector<GpuPhysicsObject> objects(m_objectCount);
+  std::vector<glm::vec4> velocities(m_objectCount);
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_objectBuffer);
+  glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                     objects.size() * sizeof(GpuPhysicsObject),
+                     objects.data());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_velocityBuffer);
+  glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                     velocities.size() * sizeof(glm::vec4),
+                     velocities.data());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  particles.resize(m_objectCount);
+  for (size_t i = 0; i < m_objectCount; ++i) {
+    particles.setPosition(i, objects[i].position);
+    particles.setVelocity(i, glm::vec3(velocities[i]));
+    particles.invMass[i] = velocities[i].w;
+    particles.radius[i] = objects[i].radius;
+    particles.color[i] = objects[i].color;
+    particles.restTime[i] = 0.0f;
+    particles.asleep[i] = 0;
+  }
+}
+
+// Same dimensions as SpatialGrid. The scan pass leaves the counts at zero,
+// so they only need clearing when the grid is reallocated.
+void GpuPhysics::resizeGrid() {
+  m_cellSize = m_constants.USE_3D ? m_constants.CELL_SIZE_3D
+                                  : m_constants.CELL_SIZE_2D;
+  glm::ivec3 cells(
+      std::max(static_cast<int>(std::ceil(m_constants.WORLD_WIDTH /
+                                          m_cellSize)),
+               1),
+      std::max(static_cast<int>(std::ceil(m_constants.WORLD_HEIGHT /
+                                          m_cellSize)),
+               1),
+      std::max(static_cast<int>(std::ceil(m_constants.WORLD_DEPTH /
+                                          m_cellSize)),
+               1));
+  if (cells == m_gridCells) {
+    return;
+  }
+  m_gridCells = cells;
+  size_t totalCells = static_cast<size_t>(cells.x) * cells.y * cells.z;
+  std::vector<uint32_t> zeros(totalCells, 0);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_cellCountBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, totalCells * sizeof(uint32_t),
+               zeros.data(), GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_cellStartBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, (totalCells + 1) * sizeof(uint32_t),
+               nullptr, GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void GpuPhysics::bindBuffers() const {
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OBJECTS_BINDING, m_objectBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VELOCITIES_BINDING,
+                   m_velocityBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CELL_COUNTS_BINDING,
+                   m_cellCountBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CELL_STARTS_BINDING,
+                   m_cellStartBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OBJECT_CELLS_BINDING,
+                   m_objectCellBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SORTED_INDICES_BINDING,
+                   m_sortedIndexBuffer);
+}
+
+void GpuPhysics::step() {
+  PROFILE_SCOPE("GPU Physics Dispatch");
+  m_stats.stepMs = m_timer.lastMs();
+  // Pairs are not counted on the GPU.
+  m_stats.pairTests = 0;
+  // Nothing sleeps on the GPU, and the substep count is always fixed.
+  m_stats.awakeObjects = m_objectCount;
+  m_stats.substeps = std::max(m_constants.PHYSICS_ITERATIONS, 1);
+  if (m_objectCount == 0) {
+    return;
+  }
+
+  resizeGrid();
+  bindBuffers();
+  m_timer.begin();
+  const int iterations = std::max(m_constants.PHYSICS_ITERATIONS, 1);
+  const float SUB_DELTA_TIME = m_constants.FIXED_DELTA_TIME / iterations;
+  for (int iter = 0; iter < iterations; ++iter) {
+    substep(SUB_DELTA_TIME);
+  }
+  m_timer.end();
+}
+
+void GpuPhysics::substep(float dt) {
+  const bool is3D = m_constants.USE_3D;
+  const int numCells = m_gridCells.x * m_gridCells.y * m_gridCells.z;
+
+  m_integrateShader->use();
+  m_integrateShader->setInt("numObjects", static_cast<int>(m_objectCount));
+  m_integrateShader->setFloat("dt", dt);
+  m_integrateShader->setFloat("gravity", m_constants.GRAVITY);
+  m_integrateShader->setFloat("damping", m_constants.VERTICAL_DAMPING);
+  m_integrateShader->setVec3("worldSize", glm::vec3(m_constants.WORLD_WIDTH,
+                                                    m_constants.WORLD_HEIGHT,
+                                                    m_constants.WORLD_DEPTH));
+  m_integrateShader->setBool("use3D", is3D);
+  m_integrateShader->setFloat("cellSize", m_cellSize);
+  m_integrateShader->setIVec3("gridCells", m_gridCells);
+  glDispatchCompute(groupsFor(m_objectCount, OBJECT_GROUP_SIZE), 1, 1);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  m_scanShader->use();
+  m_scanShader->setInt("numCells", numCells);
+  glDispatchCompute(1, 1, 1);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  m_scatterShader->use();
+  m_scatterShader->setInt("numObjects", static_cast<int>(m_objectCount));
+  glDispatchCompute(groupsFor(m_objectCount, OBJECT_GROUP_SIZE), 1, 1);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  // One dispatch per colour; the barrier in between is what makes the
+  // colours run one after another like the CPU solver's.
+  m_collideShader->use();
+  m_collideShader->setIVec3("gridCells", m_gridCells);
+  m_collideShader->setBool("use3D", is3D);
+  m_collideShader->setFloat("restitution",
+                            m_constants.COEFFICIENT_OF_RESTITUTION);
+  const int colors = is3D ? 27 : 9;
+  for (int color = 0; color < colors; ++color) {
+    glm::ivec3 origin(color % 3, (color / 3) % 3, color / 9);
+    glm::ivec3 cells = glm::max((m_gridCells - origin + 2) / 3, 0);
+    if (!is3D) {
+      cells.z = 1;
+    }
+    size_t total = static_cast<size_t>(cells.x) * cells.y * cells.z;
+    if (total == 0) {
+      continue;
+    }
+    m_collideShader->setIVec3("colorOrigin", origin);
+    m_collideShader->setIVec3("colorCells", cells);
+    glDispatchCompute(groupsFor(total, CELL_GROUP_SIZE), 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+  }
+}
@@ -0,0 +1,45 @@
+#include "../include/GpuTimer.hpp"
+
+GpuTimer::GpuTimer() { glGenQueries(2 * LATENCY, &m_queries[0][0]); }
+
+GpuTimer::~GpuTimer() { glDeleteQueries(2 * LATENCY, &m_queries[0][0]); }
+
+// Oldest first, so m_lastMs ends up holding the newest result.
+void GpuTimer::collect() {
+  for (int n = 0; n < LATENCY; ++n) {
+    int slot = (m_next + n) % LATENCY;
+    if (!m_pending[slot]) {
+      continue;
+    }
+    GLint available = GL_FALSE;
+    glGetQueryObjectiv(m_queries[slot][1], GL_QUERY_RESULT_AVAILABLE,
+                       &available);
+    if (!available) {
+      continue;
+    }
+    GLuint64 start = 0;
+    GLuint64 end = 0;
+    glGetQueryObjectui64v(m_queries[slot][0], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(m_queries[slot][1], GL_QUERY_RESULT, &end);
+    m_lastMs = static_cast<float>(end - start) / 1.0e6f;
+    m_pending[slot] = false;
+  }
+}
+
+void GpuTimer::begin() {
+  collect();
+  m_active = !m_pending[m_next];
+  if (m_active) {
+    glQueryCounter(m_queries[m_next][0], GL_TIMESTAMP);
+  }
+}
+
+void GpuTimer::end() {
+  if (!m_active) {
+    return;
+  }
+  glQueryCounter(m_queries[m_next][1], GL_TIMESTAMP);
+  m_pending[m_next] = true;
+  m_next = (m_next + 1) % LATENCY;
+  m_active = false;
+}
@@ -0,0 +1,132 @@
+#include "../include/ImpostorRenderer.hpp"
+#include "../include/Profiler.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+// Half-size of the floor quad; the camera's far plane is closer than this.
+static constexpr float FLOOR_EXTENT = 100000.0f;
+
+static GLuint createVertexArray(GLuint &buffer, const float *vertices,
+                                size_t floats) {
+  GLuint vao;
+  glGenVertexArrays(1, &vao);
+  glGenBuffers(1, &buffer);
+  glBindVertexArray(vao);
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glBufferData(GL_ARRAY_BUFFER, floats * sizeof(float), vertices,
+               GL_STATIC_DRAW);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float),
+                        (void *)0);
+  glEnableVertexAttribArray(0);
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  return vao;
+}
+
+ImpostorRenderer::ImpostorRenderer() {
+  m_objectShader =
+      std::make_unique<Shader>("shaders/object.vert", "shaders/object.frag");
+  m_floorShader =
+      std::make_unique<Shader>("shaders/floor.vert", "shaders/floor.frag");
+  m_lineShader =
+      std::make_unique<Shader>("shaders/line.vert", "shaders/line.frag");
+
+  glGenVertexArrays(1, &m_objectVao);
+
+  const float floorVertices[] = {-1.0f, 0.0f, -1.0f, 1.0f, 0.0f, -1.0f,
+                                 -1.0f, 0.0f, 1.0f,  1.0f, 0.0f, 1.0f};
+  m_floorVao = createVertexArray(m_floorVbo, floorVertices, 12);
+
+  // The twelve edges of the unit cube.
+  float lineVertices[24 * 3];
+  size_t next = 0;
+  for (int axis = 0; axis < 3; ++axis) {
+    for (int corner = 0; corner < 4; ++corner) {
+      for (int end = 0; end < 2; ++end) {
+        glm::vec3 vertex;
+        vertex[axis] = static_cast<float>(end);
+        vertex[(axis + 1) % 3] = static_cast<float>(corner & 1);
+        vertex[(axis + 2) % 3] = static_cast<float>(corner >> 1);
+        for (int i = 0; i < 3; ++i) {
+          lineVertices[next++] = vertex[i];
+        }
+      }
+    }
+  }
+  m_lineVao = createVertexArray(m_lineVbo, lineVertices, 24 * 3);
+}
+
+ImpostorRenderer::~ImpostorRenderer() {
+  GLuint arrays[] = {m_objectVao, m_floorVao, m_lineVao};
+  glDeleteVertexArrays(3, arrays);
+  GLuint buffers[] = {m_floorVbo, m_lineVbo};
+  glDeleteBuffers(2, buffers);
+  for (Shader *shader :
+       {m_objectShader.get(), m_floorShader.get(), m_lineShader.get()}) {
+    glDeleteProgram(shader->ID);
+  }
+}
+
+bool ImpostorRenderer::isReady() const {
+  for (Shader *shader :
+       {m_objectShader.get(), m_floorShader.get(), m_lineShader.get()}) {
+    GLint linked = GL_FALSE;
+    glGetProgramiv(shader->ID, GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void ImpostorRenderer::render(size_t numObjects, size_t numLights,
+                              const glm::mat4 &view,
+                              const glm::mat4 &projection,
+                              const glm::vec3 &cameraPos,
+                              const glm::vec3 &boundsMin,
+                              const glm::vec3 &boundsMax) {
+  PROFILE_SCOPE("Impostor Draw");
+  // The raytracer's sky colour.
+  const float sky[] = {0.5f, 0.7f, 1.0f, 1.0f};
+  glClearBufferfv(GL_COLOR, 0, sky);
+  glClear(GL_DEPTH_BUFFER_BIT);
+  glEnable(GL_DEPTH_TEST);
+
+  m_floorShader->use();
+  m_floorShader->setMat4(
+      "model", glm::scale(glm::mat4(1.0f), glm::vec3(FLOOR_EXTENT)));
+  m_floorShader->setMat4("view", view);
+  m_floorShader->setMat4("projection", projection);
+  m_floorShader->setVec3("cameraPos", cameraPos);
+  m_floorShader->setInt("numLights", static_cast<int>(numLights));
+  glBindVertexArray(m_floorVao);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+  // From inside the box the raytracer's outline never shows.
+  const bool outside = glm::any(glm::lessThan(cameraPos, boundsMin)) ||
+                       glm::any(glm::greaterThan(cameraPos, boundsMax));
+  if (outside) {
+    m_lineShader->use();
+    m_lineShader->setMat4(
+        "model", glm::scale(glm::translate(glm::mat4(1.0f), boundsMin),
+                            boundsMax - boundsMin));
+    m_lineShader->setMat4("view", view);
+    m_lineShader->setMat4("projection", projection);
+    m_lineShader->setVec3("u_color", glm::vec3(0.0f, 0.8f, 0.0f));
+    glBindVertexArray(m_lineVao);
+    glDrawArrays(GL_LINES, 0, 24);
+  }
+
+  if (numObjects > 0) {
+    m_objectShader->use();
+    m_objectShader->setMat4("view", view);
+    m_objectShader->setMat4("projection", projection);
+    m_objectShader->setInt("numLights", static_cast<int>(numLights));
+    glBindVertexArray(m_objectVao);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4,
+                          static_cast<GLsizei>(numObjects));
+  }
+
+  glBindVertexArray(0);
+  glDisable(GL_DEPTH_TEST);
+}
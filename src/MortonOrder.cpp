@@ -0,0 +1,88 @@
+#include "../include/MortonOrder.hpp"
+#include "../include/Profiler.hpp"
+
+#include <algorithm>
+
+void MortonOrder::compute(const ParticleStore &particles,
+                          const SpatialGrid &grid, bool is3D,
+                          TaskScheduler &scheduler) {
+  PROFILE_SCOPE("Morton Sort");
+  const size_t numObjects = particles.size();
+  m_keys.resize(numObjects);
+  m_order.resize(numObjects);
+  m_sortedKeys.resize(numObjects);
+  m_sortedOrder.resize(numObjects);
+  m_remap.resize(numObjects);
+  if (numObjects == 0) {
+    return;
+  }
+
+  scheduler.parallelFor(0, numObjects, 0, [&](size_t start_idx,
+                                             size_t end_idx) {
+    for (size_t i = start_idx; i < end_idx; ++i) {
+      m_keys[i] = grid.mortonKey(particles.position(i), is3D);
+      m_order[i] = static_cast<uint32_t>(i);
+    }
+  });
+
+  // Every block scatters its own slice in order into slots reserved for it
+  // behind the earlier blocks, which keeps each pass stable.
+  const size_t numBlocks =
+      std::min(numObjects, scheduler.getNumThreads() * static_cast<size_t>(4));
+  auto blockBegin = [&](size_t block) {
+    return block * numObjects / numBlocks;
+  };
+  m_blockDigits.resize(numBlocks * RADIX);
+  for (int shift = 0; shift < grid.mortonBits(is3D); shift += RADIX_BITS) {
+    std::fill(m_blockDigits.begin(), m_blockDigits.end(), 0);
+    scheduler.parallelFor(0, numBlocks, 1, [&](size_t start_idx,
+                                              size_t end_idx) {
+      for (size_t b = start_idx; b < end_idx; ++b) {
+        uint32_t *counts = &m_blockDigits[b * RADIX];
+        for (size_t i = blockBegin(b); i < blockBegin(b + 1); ++i) {
+          ++counts[(m_keys[i] >> shift) & (RADIX - 1)];
+        }
+      }
+    });
+
+    // A digit every key shares would leave the order as it is.
+    const uint64_t digit = (m_keys[0] >> shift) & (RADIX - 1);
+    uint64_t shared = 0;
+    for (size_t b = 0; b < numBlocks; ++b) {
+      shared += m_blockDigits[b * RADIX + digit];
+    }
+    if (shared == numObjects) {
+      continue;
+    }
+
+    uint32_t offset = 0;
+    for (size_t d = 0; d < RADIX; ++d) {
+      for (size_t b = 0; b < numBlocks; ++b) {
+        uint32_t count = m_blockDigits[b * RADIX + d];
+        m_blockDigits[b * RADIX + d] = offset;
+        offset += count;
+      }
+    }
+
+    scheduler.parallelFor(0, numBlocks, 1, [&](size_t start_idx,
+                                              size_t end_idx) {
+      for (size_t b = start_idx; b < end_idx; ++b) {
+        uint32_t *slots = &m_blockDigits[b * RADIX];
+        for (size_t i = blockBegin(b); i < blockBegin(b + 1); ++i) {
+          uint32_t slot = slots[(m_keys[i] >> shift) & (RADIX - 1)]++;
+          m_sortedKeys[slot] = m_keys[i];
+          m_sortedOrder[slot] = m_order[i];
+        }
+      }
+    });
+    m_keys.swap(m_sortedKeys);
+    m_order.swap(m_sortedOrder);
+  }
+
+  scheduler.parallelFor(0, numObjects, 0, [&](size_t start_idx,
+                                             size_t end_idx) {
+    for (size_t i = start_idx; i < end_idx; ++i) {
+      m_remap[m_order[i]] = static_cast<uint32_t>(i);
+    }
+  });
+}
@@ -0,0 +1,120 @@
+#include "../include/NarrowPhase.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NARROW_PHASE_X86 1
+#include <immintrin.h>
+#endif
+
+static size_t overlapScalar(float qx, float qy, float qz, float qr,
+                            const CandidateBatch &batch, size_t begin,
+                            uint32_t *hits) {
+  size_t num_hits = 0;
+  for (size_t k = begin; k < batch.size(); ++k) {
+    float dx = batch.x[k] - qx;
+    float dy = batch.y[k] - qy;
+    float dz = batch.z[k] - qz;
+    float sum_radii = batch.radius[k] + qr;
+    if (dx * dx + dy * dy + dz * dz <= sum_radii * sum_radii) {
+      hits[num_hits++] = static_cast<uint32_t>(k);
+    }
+  }
+  return num_hits;
+}
+
+#ifdef NARROW_PHASE_X86
+// Both vector kernels use separate multiplies and adds rather than FMA so
+// they accept exactly the same pairs as the scalar test in collision().
+__attribute__((target("avx2"))) static size_t
+overlapAvx2(float qx, float qy, float qz, float qr,
+            const CandidateBatch &batch, size_t begin, uint32_t *hits) {
+  const __m256 query_x = _mm256_set1_ps(qx);
+  const __m256 query_y = _mm256_set1_ps(qy);
+  const __m256 query_z = _mm256_set1_ps(qz);
+  const __m256 query_r = _mm256_set1_ps(qr);
+  const size_t count = batch.size();
+  size_t num_hits = 0;
+  size_t k = begin;
+  for (; k + 8 <= count; k += 8) {
+    __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(&batch.x[k]), query_x);
+    __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(&batch.y[k]), query_y);
+    __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(&batch.z[k]), query_z);
+    __m256 dist_sq = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+        _mm256_mul_ps(dz, dz));
+    __m256 sum_radii =
+        _mm256_add_ps(_mm256_loadu_ps(&batch.radius[k]), query_r);
+    unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_cmp_ps(
+        dist_sq, _mm256_mul_ps(sum_radii, sum_radii), _CMP_LE_OQ)));
+    while (mask != 0) {
+      hits[num_hits++] = static_cast<uint32_t>(k + __builtin_ctz(mask));
+      mask &= mask - 1;
+    }
+  }
+  if (k < count) {
+    num_hits += overlapScalar(qx, qy, qz, qr, batch, k, hits + num_hits);
+  }
+  return num_hits;
+}
+
+__attribute__((target("avx512f"))) static size_t
+overlapAvx512(float qx, float qy, float qz, float qr,
+              const CandidateBatch &batch, size_t begin, uint32_t *hits) {
+  const __m512 query_x = _mm512_set1_ps(qx);
+  const __m512 query_y = _mm512_set1_ps(qy);
+  const __m512 query_z = _mm512_set1_ps(qz);
+  const __m512 query_r = _mm512_set1_ps(qr);
+  const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                          11, 12, 13, 14, 15);
+  const size_t count = batch.size();
+  size_t num_hits = 0;
+  size_t k = begin;
+  for (; k + 16 <= count; k += 16) {
+    __m512 dx = _mm512_sub_ps(_mm512_loadu_ps(&batch.x[k]), query_x);
+    __m512 dy = _mm512_sub_ps(_mm512_loadu_ps(&batch.y[k]), query_y);
+    __m512 dz = _mm512_sub_ps(_mm512_loadu_ps(&batch.z[k]), query_z);
+    __m512 dist_sq = _mm512_add_ps(
+        _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)),
+        _mm512_mul_ps(dz, dz));
+    __m512 sum_radii =
+        _mm512_add_ps(_mm512_loadu_ps(&batch.radius[k]), query_r);
+    __mmask16 mask = _mm512_cmp_ps_mask(
+        dist_sq, _mm512_mul_ps(sum_radii, sum_radii), _CMP_LE_OQ);
+    _mm512_mask_compressstoreu_epi32(
+        hits + num_hits, mask,
+        _mm512_add_epi32(_mm512_set1_epi32(static_cast<int>(k)), lanes));
+    num_hits += __builtin_popcount(mask);
+  }
+  if (k < count) {
+    num_hits += overlapScalar(qx, qy, qz, qr, batch, k, hits + num_hits);
+  }
+  return num_hits;
+}
+#endif
+
+static OverlapKernel selectOverlapKernel(const char **name) {
+#ifdef NARROW_PHASE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    *name = "AVX-512";
+    return overlapAvx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    *name = "AVX2";
+    return overlapAvx2;
+  }
+#endif
+  *name = "Scalar";
+  return overlapScalar;
+}
+
+static const char *s_kernelName = nullptr;
+
+OverlapKernel overlapKernel() {
+  static const OverlapKernel kernel = selectOverlapKernel(&s_kernelName);
+  return kernel;
+}
+
+const char *overlapKernelName() {
+  overlapKernel();
+  return s_kernelName;
+}
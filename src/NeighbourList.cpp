@@ -0,0 +1,102 @@
+#include "../include/NeighbourList.hpp"
+#include "../include/Profiler.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+void NeighbourList::build(const ParticleStore &particles,
+                          const SpatialGrid &grid,
+                          const std::vector<int> &cells, float skin,
+                          bool is3D, TaskScheduler &scheduler) {
+  PROFILE_SCOPE("Neighbour List Build");
+  m_skin = std::clamp(skin, 0.0f, maxSkin(particles, grid.cellSize()));
+
+  const size_t numCells = cells.size();
+  const size_t numBlocks =
+      std::min(numCells, scheduler.getNumThreads() * static_cast<size_t>(4));
+  m_blockPairs.resize(numBlocks);
+  m_blockOffsets.assign(numBlocks + 1, 0);
+  m_cellStart.resize(numCells + 1);
+  auto blockBegin = [&](size_t block) {
+    return block * numCells / numBlocks;
+  };
+
+  // Each block collects its cells' pairs on its own, with cell starts
+  // relative to the block, and is then copied into place.
+  scheduler.parallelFor(0, numBlocks, 1, [&](size_t start_idx,
+                                             size_t end_idx) {
+    for (size_t b = start_idx; b < end_idx; ++b) {
+      std::vector<NeighbourPair> &out = m_blockPairs[b];
+      out.clear();
+      for (size_t c = blockBegin(b); c < blockBegin(b + 1); ++c) {
+        m_cellStart[c] = static_cast<uint32_t>(out.size());
+        grid.processCellPairs(cells[c], is3D, [&](uint32_t i, uint32_t j) {
+          glm::vec3 delta = particles.position(j) - particles.position(i);
+          float reach = particles.radius[i] + particles.radius[j] + m_skin;
+          if (glm::dot(delta, delta) <= reach * reach) {
+            out.push_back({i, j});
+          }
+        });
+      }
+      m_blockOffsets[b + 1] = static_cast<uint32_t>(out.size());
+    }
+  });
+  for (size_t b = 0; b < numBlocks; ++b) {
+    m_blockOffsets[b + 1] += m_blockOffsets[b];
+  }
+
+  m_pairs.resize(m_blockOffsets[numBlocks]);
+  scheduler.parallelFor(0, numBlocks, 1, [&](size_t start_idx,
+                                             size_t end_idx) {
+    for (size_t b = start_idx; b < end_idx; ++b) {
+      const uint32_t offset = m_blockOffsets[b];
+      std::copy(m_blockPairs[b].begin(), m_blockPairs[b].end(),
+                m_pairs.begin() + offset);
+      for (size_t c = blockBegin(b); c < blockBegin(b + 1); ++c) {
+        m_cellStart[c] += offset;
+      }
+    }
+  });
+  m_cellStart[numCells] = m_blockOffsets[numBlocks];
+
+  m_buildX = particles.posX;
+  m_buildY = particles.posY;
+  m_buildZ = particles.posZ;
+  m_valid = true;
+}
+
+// The stencil reaches one cell in every direction, so a pair further apart
+// than the cell size could be missed.
+float NeighbourList::maxSkin(const ParticleStore &particles, float cellSize) {
+  const float max_radius =
+      particles.empty()
+          ? 0.0f
+          : *std::max_element(particles.radius.begin(), particles.radius.end());
+  return std::max(0.0f, cellSize - 2.0f * max_radius);
+}
+
+bool NeighbourList::needsRebuild(const ParticleStore &particles,
+                                 TaskScheduler &scheduler) const {
+  if (!m_valid || m_buildX.size() != particles.size()) {
+    return true;
+  }
+  PROFILE_SCOPE("Neighbour List Check");
+  const float limit_sq = 0.25f * m_skin * m_skin;
+  std::atomic<bool> moved = false;
+  scheduler.parallelFor(
+      0, particles.size(), 0, [&](size_t start_idx, size_t end_idx) {
+        if (moved.load(std::memory_order_relaxed)) {
+          return;
+        }
+        for (size_t i = start_idx; i < end_idx; ++i) {
+          float dx = particles.posX[i] - m_buildX[i];
+          float dy = particles.posY[i] - m_buildY[i];
+          float dz = particles.posZ[i] - m_buildZ[i];
+          if (dx * dx + dy * dy + dz * dz > limit_sq) {
+            moved.store(true, std::memory_order_relaxed);
+            return;
+          }
+        }
+      });
+  return moved.load();
+}
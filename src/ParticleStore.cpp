@@ -0,0 +1,99 @@
+#include "../include/ParticleStore.hpp"
+
+#include <random>
+
+ParticleStore::ParticleStore(const ParticleStore &other) { *this = other; }
+
+ParticleStore &ParticleStore::operator=(const ParticleStore &other) {
+  if (this == &other) {
+    return *this;
+  }
+  posX = other.posX;
+  posY = other.posY;
+  posZ = other.posZ;
+  velX = other.velX;
+  velY = other.velY;
+  velZ = other.velZ;
+  invMass = other.invMass;
+  radius = other.radius;
+  color = other.color;
+  restTime = other.restTime;
+  asleep = other.asleep;
+  if (m_locks.size() != other.size()) {
+    m_locks = std::vector<std::mutex>(other.size());
+  }
+  return *this;
+}
+
+void ParticleStore::clear() { resize(0); }
+
+void ParticleStore::resize(size_t count) {
+  posX.resize(count);
+  posY.resize(count);
+  posZ.resize(count);
+  velX.resize(count);
+  velY.resize(count);
+  velZ.resize(count);
+  invMass.resize(count);
+  radius.resize(count);
+  color.resize(count);
+  restTime.resize(count);
+  asleep.resize(count);
+  if (m_locks.size() != count) {
+    m_locks = std::vector<std::mutex>(count);
+  }
+}
+
+template <typename T>
+static void gather(std::vector<T> &values, const std::vector<uint32_t> &order,
+                   TaskScheduler &scheduler) {
+  std::vector<T> gathered(values.size());
+  scheduler.parallelFor(0, order.size(), 0,
+                        [&](size_t start_idx, size_t end_idx) {
+                          for (size_t i = start_idx; i < end_idx; ++i) {
+                            gathered[i] = values[order[i]];
+                          }
+                        });
+  values.swap(gathered);
+}
+
+void ParticleStore::reorder(const std::vector<uint32_t> &order,
+                            TaskScheduler &scheduler) {
+  gather(posX, order, scheduler);
+  gather(posY, order, scheduler);
+  gather(posZ, order, scheduler);
+  gather(velX, order, scheduler);
+  gather(velY, order, scheduler);
+  gather(velZ, order, scheduler);
+  gather(invMass, order, scheduler);
+  gather(radius, order, scheduler);
+  gather(color, order, scheduler);
+  gather(restTime, order, scheduler);
+  gather(asleep, order, scheduler);
+}
+
+void ParticleStore::spawnRandom(const SimulationConstants &constants,
+                                int count, bool is3D, float objectRadius,
+                                float objectMass, unsigned int seed) {
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<float> x_rand(0, constants.WORLD_WIDTH);
+  std::uniform_real_distribution<float> y_rand(0, constants.WORLD_HEIGHT);
+  std::uniform_real_distribution<float> z_rand(0, constants.WORLD_DEPTH);
+  std::uniform_real_distribution<float> vel_rand(constants.OBJECT_MIN_VEL,
+                                                 constants.OBJECT_MAX_VEL);
+
+  resize(count);
+  for (int i = 0; i < count; ++i) {
+    posX[i] = x_rand(gen);
+    posY[i] = y_rand(gen);
+    posZ[i] = is3D ? z_rand(gen) : 0.0f;
+    velX[i] = vel_rand(gen);
+    velY[i] = vel_rand(gen);
+    velZ[i] = is3D ? vel_rand(gen) : 0.0f;
+    radius[i] = objectRadius;
+    invMass[i] = 1.0f / objectMass;
+    color[i] = glm::vec3(1.0f, 1.0f, 1.0f);
+    restTime[i] = 0.0f;
+    asleep[i] = 0;
+  }
+}
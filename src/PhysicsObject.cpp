@@ -1,71 +1,95 @@
 #include "../include/PhysicsObject.hpp"
-#include <glm/gtc/random.hpp>
-#include <random>
-#define GLM_ENABLE_EXPERIMENTAL
-#include <glm/gtx/norm.hpp>
-
-PhysicsObject::PhysicsObject(const SimulationConstants &constants, bool is3D,
-                             float radius, float mass)
-    : m_constants(constants) {
-  std::random_device rd;
-  std::mt19937 gen(rd());
-  std::uniform_real_distribution<float> x_rand(0, m_constants.WORLD_WIDTH);
-  std::uniform_real_distribution<float> y_rand(0, m_constants.WORLD_HEIGHT);
-  std::uniform_real_distribution<float> z_rand(0, m_constants.WORLD_DEPTH);
-  std::uniform_real_distribution<float> vel_rand(m_constants.OBJECT_MIN_VEL,
-                                                 m_constants.OBJECT_MAX_VEL);
-
-  m_pos = glm::vec3(x_rand(gen), y_rand(gen), is3D ? z_rand(gen) : 0.0f);
-  m_rad = radius;
-  m_mass = mass;
-  m_vel = glm::vec3(vel_rand(gen), vel_rand(gen), is3D ? vel_rand(gen) : 0.0f);
-
-  m_color = glm::vec3(1.0f, 1.0f, 1.0f);
+
+#include <cmath>
+#include <mutex>
+
+void PhysicsObject::update(float dt, const SimulationConstants &constants) {
+  integrate(*m_store, m_index, m_index + 1, dt, constants);
 }
 
-void PhysicsObject::update(float dt) {
-  m_vel.y += m_constants.GRAVITY * dt;
-  m_pos += m_vel * dt;
-  preventBorderCollision(m_constants.USE_3D);
+void PhysicsObject::preventBorderCollision(
+    const SimulationConstants &constants, bool is3D) {
+  ::preventBorderCollision(*m_store, m_index, constants, is3D);
 }
 
-void PhysicsObject::preventBorderCollision(bool is3D) {
+void integrate(ParticleStore &store, size_t start_idx, size_t end_idx,
+               float dt, const SimulationConstants &constants) {
+  float *posX = store.posX.data();
+  float *posY = store.posY.data();
+  float *posZ = store.posZ.data();
+  float *velX = store.velX.data();
+  float *velY = store.velY.data();
+  float *velZ = store.velZ.data();
+  const char *asleep = store.asleep.data();
+
+  // A select rather than a branch keeps the loop vectorisable; asleep
+  // objects have zero velocity, so a zero step leaves them in place.
+  for (size_t i = start_idx; i < end_idx; ++i) {
+    const float step = asleep[i] ? 0.0f : dt;
+    velY[i] += constants.GRAVITY * step;
+    posX[i] += velX[i] * step;
+    posY[i] += velY[i] * step;
+    posZ[i] += velZ[i] * step;
+  }
+  for (size_t i = start_idx; i < end_idx; ++i) {
+    if (!asleep[i]) {
+      preventBorderCollision(store, i, constants, constants.USE_3D);
+    }
+  }
+}
 
-  if (m_pos.x + m_rad > m_constants.WORLD_WIDTH) {
-    m_pos.x = m_constants.WORLD_WIDTH - m_rad;
-    m_vel.x *= -m_constants.VERTICAL_DAMPING;
-  } else if (m_pos.x - m_rad < 0) {
-    m_pos.x = m_rad;
-    m_vel.x *= -m_constants.VERTICAL_DAMPING;
+void preventBorderCollision(ParticleStore &store, size_t i,
+                            const SimulationConstants &constants, bool is3D) {
+  const float rad = store.radius[i];
+  float &posX = store.posX[i];
+  float &posY = store.posY[i];
+  float &posZ = store.posZ[i];
+  float &velX = store.velX[i];
+  float &velY = store.velY[i];
+  float &velZ = store.velZ[i];
+
+  if (posX + rad > constants.WORLD_WIDTH) {
+    posX = constants.WORLD_WIDTH - rad;
+    velX *= -constants.VERTICAL_DAMPING;
+  } else if (posX - rad < 0) {
+    posX = rad;
+    velX *= -constants.VERTICAL_DAMPING;
   }
-  if (m_pos.y + m_rad > m_constants.WORLD_HEIGHT) {
-    m_pos.y = m_constants.WORLD_HEIGHT - m_rad;
-    m_vel.y *= -m_constants.VERTICAL_DAMPING;
-  } else if (m_pos.y - m_rad < 0) {
-    m_pos.y = m_rad;
-    m_vel.y *= -m_constants.VERTICAL_DAMPING;
+  if (posY + rad > constants.WORLD_HEIGHT) {
+    posY = constants.WORLD_HEIGHT - rad;
+    velY *= -constants.VERTICAL_DAMPING;
+  } else if (posY - rad < 0) {
+    posY = rad;
+    velY *= -constants.VERTICAL_DAMPING;
   }
 
   if (is3D) {
-    if (m_pos.z + m_rad > m_constants.WORLD_DEPTH) {
-      m_pos.z = m_constants.WORLD_DEPTH - m_rad;
-      m_vel.z *= -m_constants.VERTICAL_DAMPING;
-    } else if (m_pos.z - m_rad < 0) {
-      m_pos.z = m_rad;
-      m_vel.z *= -m_constants.VERTICAL_DAMPING;
+    if (posZ + rad > constants.WORLD_DEPTH) {
+      posZ = constants.WORLD_DEPTH - rad;
+      velZ *= -constants.VERTICAL_DAMPING;
+    } else if (posZ - rad < 0) {
+      posZ = rad;
+      velZ *= -constants.VERTICAL_DAMPING;
     }
   }
 }
 
-void collision(PhysicsObject &o1, PhysicsObject &o2,
-               const SimulationConstants &constants) {
-  glm::vec3 deltaPos = o2.position() - o1.position();
+template <bool TLocked>
+static void resolveCollision(ParticleStore &store, uint32_t i, uint32_t j,
+                             const SimulationConstants &constants) {
+  bool asleep_i = store.isAsleep(i);
+  bool asleep_j = store.isAsleep(j);
+  if (asleep_i && asleep_j) {
+    return;
+  }
+
+  glm::vec3 deltaPos = store.position(j) - store.position(i);
   if (!constants.USE_3D) {
     deltaPos.z = 0;
   }
 
   float distanceSq = glm::dot(deltaPos, deltaPos);
-  float sumRadii = o1.radius() + o2.radius();
+  float sumRadii = store.radius[i] + store.radius[j];
   float sumRadiiSq = sumRadii * sumRadii;
 
   if (distanceSq > sumRadiiSq) {
@@ -79,31 +103,60 @@ void collision(PhysicsObject &o1, PhysicsObject &o2,
   }
 
   glm::vec3 normal = deltaPos / distance;
-  glm::vec3 rel_vel = o2.velocity() - o1.velocity();
+  glm::vec3 rel_vel = store.velocity(j) - store.velocity(i);
   float vel_along_normal = glm::dot(rel_vel, normal);
 
   if (vel_along_normal > 0) {
     return;
   }
 
-  std::lock(o1.m_mutex, o2.m_mutex);
-  std::lock_guard<std::mutex> lock1(o1.m_mutex, std::adopt_lock);
-  std::lock_guard<std::mutex> lock2(o2.m_mutex, std::adopt_lock);
+  std::unique_lock<std::mutex> lock1;
+  std::unique_lock<std::mutex> lock2;
+  if constexpr (TLocked) {
+    lock1 = std::unique_lock<std::mutex>(store.lock(i), std::defer_lock);
+    lock2 = std::unique_lock<std::mutex>(store.lock(j), std::defer_lock);
+    std::lock(lock1, lock2);
+  }
+
+  // A sleeper is woken by an impact above the sleep velocity and otherwise
+  // stays put, as if its mass were infinite. Resting contact therefore
+  // does not keep waking a settled pile.
+  if ((asleep_i || asleep_j) &&
+      -vel_along_normal > constants.SLEEP_VELOCITY) {
+    store.wake(i);
+    store.wake(j);
+    asleep_i = asleep_j = false;
+  }
+
+  const float inv_mass1 = asleep_i ? 0.0f : store.invMass[i];
+  const float inv_mass2 = asleep_j ? 0.0f : store.invMass[j];
+  const float total_inv_mass = inv_mass1 + inv_mass2;
 
   float overlap = sumRadii - distance;
   if (overlap > 0) {
-    float total_inv_mass = (1.0f / o1.mass()) + (1.0f / o2.mass());
-    float c1_correction_ratio = (1.0f / o1.mass()) / total_inv_mass;
-    float c2_correction_ratio = (1.0f / o2.mass()) / total_inv_mass;
-    o1.updatePos(-normal * overlap * c1_correction_ratio);
-    o2.updatePos(normal * overlap * c2_correction_ratio);
+    float c1_correction_ratio = inv_mass1 / total_inv_mass;
+    float c2_correction_ratio = inv_mass2 / total_inv_mass;
+    store.setPosition(i, store.position(i) -
+                             normal * overlap * c1_correction_ratio);
+    store.setPosition(j, store.position(j) +
+                             normal * overlap * c2_correction_ratio);
   }
 
-  float j =
+  float impulse_mag =
       (-(1.0f + constants.COEFFICIENT_OF_RESTITUTION) * vel_along_normal) /
-      ((1.0f / o1.mass()) + (1.0f / o2.mass()));
-  glm::vec3 impulse = j * normal;
+      total_inv_mass;
+  glm::vec3 impulse = impulse_mag * normal;
+
+  store.setVelocity(i, store.velocity(i) - impulse * inv_mass1);
+  store.setVelocity(j, store.velocity(j) + impulse * inv_mass2);
+}
+
+void collision(ParticleStore &store, uint32_t i, uint32_t j,
+               const SimulationConstants &constants) {
+  resolveCollision<true>(store, i, j, constants);
+}
 
-  o1.updateVel(o1.velocity() - impulse / o1.mass());
-  o2.updateVel(o2.velocity() + impulse / o2.mass());
+void collisionUnlocked(ParticleStore &store, uint32_t i, uint32_t j,
+                       const SimulationConstants &constants) {
+  resolveCollision<false>(store, i, j, constants);
 }
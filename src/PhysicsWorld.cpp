@@ -0,0 +1,576 @@
+#include "../include/PhysicsWorld.hpp"
+#include "../include/NarrowPhase.hpp"
+#include "../include/Profiler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+// Objects closer than this times their summed radii count as touching when
+// building sleep islands.
+static constexpr float ISLAND_CONTACT_SLOP = 1.05f;
+
+PhysicsWorld::PhysicsWorld(const SimulationConstants &constants,
+                           size_t threads)
+    : m_constants(constants),
+      m_grid(constants.WORLD_WIDTH, constants.WORLD_HEIGHT,
+             constants.WORLD_DEPTH,
+             constants.USE_3D ? constants.CELL_SIZE_3D
+                              : constants.CELL_SIZE_2D),
+      m_scheduler(std::make_unique<TaskScheduler>(threads)) {}
+
+float PhysicsWorld::cellSize() const {
+  return m_constants.USE_3D ? m_constants.CELL_SIZE_3D
+                            : m_constants.CELL_SIZE_2D;
+}
+
+void PhysicsWorld::restart() { restart(std::random_device{}()); }
+
+void PhysicsWorld::restart(unsigned int seed) {
+  m_particles.spawnRandom(m_constants, m_constants.NUM_OBJECTS,
+                          m_constants.USE_3D,
+                          m_constants.OBJECT_DEFAULT_RADIUS,
+                          m_constants.OBJECT_DEFAULT_MASS, seed);
+  m_neighbourList.invalidate();
+}
+
+void PhysicsWorld::resizeWorld() {
+  m_grid = SpatialGrid(m_constants.WORLD_WIDTH, m_constants.WORLD_HEIGHT,
+                       m_constants.WORLD_DEPTH, cellSize());
+  m_neighbourList.invalidate();
+}
+
+void PhysicsWorld::step() {
+  PROFILE_SCOPE("Physics Step");
+  auto physics_start = std::chrono::high_resolution_clock::now();
+  if (m_constants.MORTON_REORDER &&
+      ++m_framesSinceReorder >= m_constants.REORDER_INTERVAL) {
+    reorderParticles();
+  }
+  const int iterations = substepCount();
+  const float SUB_DELTA_TIME = m_constants.FIXED_DELTA_TIME / iterations;
+  uint64_t pair_tests = 0;
+  m_listRebuilds = 0;
+  for (int iter = 0; iter < iterations; ++iter) {
+    PROFILE_SCOPE("Substep");
+    pair_tests += substep(SUB_DELTA_TIME);
+  }
+  m_stats.stepMs = std::chrono::duration<float, std::milli>(
+                       std::chrono::high_resolution_clock::now() -
+                       physics_start)
+                       .count();
+  m_stats.pairTests = pair_tests / iterations;
+  m_stats.substeps = iterations;
+  m_stats.listRebuilds = m_listRebuilds;
+  m_stats.neighbourList = usesNeighbourList();
+  updateSleep(m_constants.FIXED_DELTA_TIME);
+}
+
+void PhysicsWorld::reorderParticles() {
+  PROFILE_SCOPE("Morton Reorder");
+  m_mortonOrder.compute(m_particles, m_grid, m_constants.USE_3D,
+                        *m_scheduler);
+  m_particles.reorder(m_mortonOrder.order(), *m_scheduler);
+  // Both hold particle indices; the next substep rebuilds them.
+  m_grid.invalidate();
+  m_neighbourList.invalidate();
+  m_framesSinceReorder = 0;
+  ++m_reorderCount;
+}
+
+// Lock-free union-find: roots are only ever linked below a smaller index,
+// so concurrent unions cannot form a cycle, and a failed link just retries
+// from the new roots.
+static uint32_t findIsland(std::vector<uint32_t> &parent, uint32_t i) {
+  while (true) {
+    uint32_t p = std::atomic_ref<uint32_t>(parent[i]).load(
+        std::memory_order_relaxed);
+    if (p == i) {
+      return i;
+    }
+    uint32_t grandparent = std::atomic_ref<uint32_t>(parent[p]).load(
+        std::memory_order_relaxed);
+    if (grandparent != p) {
+      // Path halving.
+      std::atomic_ref<uint32_t>(parent[i]).compare_exchange_weak(
+          p, grandparent, std::memory_order_relaxed);
+    }
+    i = grandparent;
+  }
+}
+
+static void joinIslands(std::vector<uint32_t> &parent, uint32_t a,
+                        uint32_t b) {
+  while (true) {
+    a = findIsland(parent, a);
+    b = findIsland(parent, b);
+    if (a == b) {
+      return;
+    }
+    if (a < b) {
+      std::swap(a, b);
+    }
+    uint32_t expected = a;
+    if (std::atomic_ref<uint32_t>(parent[a]).compare_exchange_strong(
+            expected, b, std::memory_order_relaxed)) {
+      return;
+    }
+  }
+}
+
+void PhysicsWorld::updateSleep(float dt) {
+  PROFILE_SCOPE("Sleep Islands");
+  const size_t count = m_particles.size();
+  if (!m_constants.SLEEPING) {
+    if (m_stats.awakeObjects != count) {
+      std::fill(m_particles.asleep.begin(), m_particles.asleep.end(), 0);
+      std::fill(m_particles.restTime.begin(), m_particles.restTime.end(),
+                0.0f);
+    }
+    m_stats.awakeObjects = count;
+    return;
+  }
+
+  m_islandParent.resize(count);
+  m_islandRestless.resize(count);
+  const float sleep_speed_sq =
+      m_constants.SLEEP_VELOCITY * m_constants.SLEEP_VELOCITY;
+  std::atomic<size_t> awake = 0;
+  m_scheduler->parallelFor(0, count, 0, [&](size_t start_idx, size_t end_idx) {
+    size_t chunk_awake = 0;
+    for (size_t i = start_idx; i < end_idx; ++i) {
+      m_islandParent[i] = static_cast<uint32_t>(i);
+      m_islandRestless[i] = 0;
+      if (!m_particles.asleep[i]) {
+        glm::vec3 velocity = m_particles.velocity(i);
+        m_particles.restTime[i] = glm::dot(velocity, velocity) < sleep_speed_sq
+                                      ? m_particles.restTime[i] + dt
+                                      : 0.0f;
+        ++chunk_awake;
+      }
+    }
+    awake.fetch_add(chunk_awake, std::memory_order_relaxed);
+  });
+  // Only an awake object can wake anything.
+  if (awake.load() == 0) {
+    m_stats.awakeObjects = 0;
+    return;
+  }
+
+  // Objects within a small slop of touching share an island. The grid is
+  // the one the last substep's contacts ran on, which is close enough: a
+  // missed edge only delays waking by a frame.
+  m_scheduler->parallelFor(
+      0, count, 128, [&](size_t start_idx, size_t end_idx) {
+        for (uint32_t i = start_idx; i < end_idx; ++i) {
+          m_grid.processPotentialColliders(
+              m_particles, i, m_constants.USE_3D, [&](uint32_t j) {
+                if (j <= i) {
+                  return;
+                }
+                glm::vec3 delta =
+                    m_particles.position(j) - m_particles.position(i);
+                float reach = ISLAND_CONTACT_SLOP *
+                              (m_particles.radius[i] + m_particles.radius[j]);
+                if (glm::dot(delta, delta) <= reach * reach) {
+                  joinIslands(m_islandParent, i, j);
+                }
+              });
+        }
+      });
+
+  m_scheduler->parallelFor(0, count, 0, [&](size_t start_idx, size_t end_idx) {
+    for (uint32_t i = start_idx; i < end_idx; ++i) {
+      if (m_particles.restTime[i] < m_constants.SLEEP_TIME) {
+        std::atomic_ref<char>(
+            m_islandRestless[findIsland(m_islandParent, i)])
+            .store(1, std::memory_order_relaxed);
+      }
+    }
+  });
+
+  awake = 0;
+  m_scheduler->parallelFor(0, count, 0, [&](size_t start_idx, size_t end_idx) {
+    size_t chunk_awake = 0;
+    for (uint32_t i = start_idx; i < end_idx; ++i) {
+      const bool sleep = !m_islandRestless[findIsland(m_islandParent, i)];
+      if (sleep && !m_particles.asleep[i]) {
+        m_particles.setVelocity(i, glm::vec3(0.0f));
+      }
+      m_particles.asleep[i] = sleep;
+      chunk_awake += !sleep;
+    }
+    awake.fetch_add(chunk_awake, std::memory_order_relaxed);
+  });
+  m_stats.awakeObjects = awake.load();
+}
+
+void PhysicsWorld::countAwake() {
+  m_stats.awakeObjects = static_cast<size_t>(
+      std::count(m_particles.asleep.begin(), m_particles.asleep.end(), 0));
+}
+
+// Non-negative floats order like their bit patterns, so the maximum can be
+// taken on the integer representation.
+static void atomicMax(std::atomic<uint32_t> &target, float value) {
+  uint32_t bits = std::bit_cast<uint32_t>(value);
+  uint32_t current = target.load(std::memory_order_relaxed);
+  while (bits > current && !target.compare_exchange_weak(
+                               current, bits, std::memory_order_relaxed)) {
+  }
+}
+
+int PhysicsWorld::substepCount() {
+  const int fixed = std::max(m_constants.PHYSICS_ITERATIONS, 1);
+  if (!m_constants.ADAPTIVE_SUBSTEPS) {
+    return fixed;
+  }
+  const int min_substeps = std::max(m_constants.MIN_SUBSTEPS, 1);
+  const int max_substeps = std::max(m_constants.MAX_SUBSTEPS, min_substeps);
+  if (m_particles.empty()) {
+    return std::clamp(fixed, min_substeps, max_substeps);
+  }
+  PROFILE_SCOPE("Substep Count");
+  std::atomic<uint32_t> max_speed_sq = 0;
+  std::atomic<uint32_t> max_inv_radius = 0;
+  m_scheduler->parallelFor(
+      0, m_particles.size(), 0, [&](size_t start_idx, size_t end_idx) {
+        float chunk_speed_sq = 0.0f;
+        float chunk_inv_radius = 0.0f;
+        for (size_t i = start_idx; i < end_idx; ++i) {
+          const float vx = m_particles.velX[i];
+          const float vy = m_particles.velY[i];
+          const float vz = m_particles.velZ[i];
+          chunk_speed_sq =
+              std::max(chunk_speed_sq, vx * vx + vy * vy + vz * vz);
+          chunk_inv_radius =
+              std::max(chunk_inv_radius, 1.0f / m_particles.radius[i]);
+        }
+        atomicMax(max_speed_sq, chunk_speed_sq);
+        atomicMax(max_inv_radius, chunk_inv_radius);
+      });
+
+  const float dt = m_constants.FIXED_DELTA_TIME;
+  // Gravity can add this much speed before the frame is over.
+  const float speed =
+      std::sqrt(std::bit_cast<float>(max_speed_sq.load())) +
+      std::abs(m_constants.GRAVITY) * dt;
+  const float length = std::min(
+      1.0f / std::bit_cast<float>(max_inv_radius.load()), cellSize());
+  const float substeps =
+      std::ceil(speed * dt / (std::max(m_constants.SUBSTEP_CFL, 1e-3f) *
+                              length));
+  return std::clamp(static_cast<int>(std::min(substeps, 1e6f)),
+                    min_substeps, max_substeps);
+}
+
+bool PhysicsWorld::usesNeighbourList() const {
+  return m_constants.BROADPHASE == Broadphase::NEIGHBOUR_LIST &&
+         NeighbourList::maxSkin(m_particles, cellSize()) > 0.0f;
+}
+
+uint64_t PhysicsWorld::substep(float dt) {
+  if (usesNeighbourList()) {
+    integrateParticles(dt);
+  } else {
+    integrateAndRebuildGrid(dt);
+  }
+  return resolveContacts();
+}
+
+void PhysicsWorld::integrateParticles(float dt) {
+  PROFILE_SCOPE("Integrate");
+  m_scheduler->parallelFor(
+      0, m_particles.size(), 0, [&](size_t start_idx, size_t end_idx) {
+        integrate(m_particles, start_idx, end_idx, dt, m_constants);
+      });
+}
+
+void PhysicsWorld::integrateAndRebuildGrid(float dt) {
+  PROFILE_SCOPE("Integrate + Grid");
+  m_grid.setUpdateSlack(
+      m_constants.INCREMENTAL_GRID ? SpatialGrid::UPDATE_SLACK : 0);
+  if (m_constants.INCREMENTAL_GRID &&
+      m_grid.beginUpdate(m_particles.size(), *m_scheduler)) {
+    m_scheduler->parallelFor(
+        0, m_grid.updateBlockCount(), 1, [&](size_t start_idx,
+                                             size_t end_idx) {
+          PROFILE_SCOPE("Integrate + Move Chunk");
+          for (size_t b = start_idx; b < end_idx; ++b) {
+            auto [begin, end] = m_grid.updateBlock(b);
+            integrate(m_particles, begin, end, dt, m_constants);
+            m_grid.findMoves(m_particles, m_constants.USE_3D, b);
+          }
+        });
+    m_grid.finishUpdate(m_particles, m_constants.USE_3D, *m_scheduler);
+    return;
+  }
+  m_grid.beginRebuild(m_particles.size());
+  m_scheduler->parallelFor(
+      0, m_particles.size(), 0, [&](size_t start_idx, size_t end_idx) {
+        PROFILE_SCOPE("Integrate + Bin Chunk");
+        integrate(m_particles, start_idx, end_idx, dt, m_constants);
+        m_grid.binObjects(m_particles, m_constants.USE_3D, start_idx,
+                          end_idx);
+      });
+  m_grid.finishRebuild(*m_scheduler);
+}
+
+void PhysicsWorld::rebuildGrid() {
+  PROFILE_SCOPE("Grid Rebuild");
+  m_grid.setUpdateSlack(
+      m_constants.INCREMENTAL_GRID ? SpatialGrid::UPDATE_SLACK : 0);
+  if (m_constants.INCREMENTAL_GRID) {
+    m_grid.update(m_particles, m_constants.USE_3D, *m_scheduler);
+  } else {
+    m_grid.rebuild(m_particles, m_constants.USE_3D, *m_scheduler);
+  }
+}
+
+uint64_t PhysicsWorld::resolveContacts() {
+  PROFILE_SCOPE("Contacts");
+  if (usesNeighbourList()) {
+    if (m_listSolver != m_constants.CONTACT_SOLVER ||
+        m_listSkin != m_constants.NEIGHBOUR_SKIN ||
+        m_neighbourList.needsRebuild(m_particles, *m_scheduler)) {
+      rebuildGrid();
+      buildNeighbourList();
+      ++m_listRebuilds;
+    }
+    return resolveListContacts();
+  }
+  m_neighbourList.invalidate();
+  std::atomic<uint64_t> pair_tests = 0;
+  const bool cell_pairs =
+      m_constants.BROADPHASE != Broadphase::OBJECT_NEIGHBOURHOOD;
+  if (m_constants.CONTACT_SOLVER == ContactSolver::CELL_COLORED) {
+    m_grid.buildColorBuckets(m_constants.USE_3D);
+    for (int color = 0;
+         color < SpatialGrid::colorCount(m_constants.USE_3D); ++color) {
+      const std::vector<int> &cells = m_grid.cellsOfColor(color);
+      m_scheduler->parallelFor(
+          0, cells.size(), 16, [&](size_t start_idx, size_t end_idx) {
+            PROFILE_SCOPE("Contact Chunk");
+            uint64_t pairs =
+                cell_pairs
+                    ? checkCollisionsForCellPairs(
+                          m_particles, m_grid, cells, start_idx, end_idx,
+                          m_constants, collisionUnlocked)
+                    : checkCollisionsForCells(m_particles, m_grid, cells,
+                                              start_idx, end_idx,
+                                              m_constants);
+            pair_tests.fetch_add(pairs, std::memory_order_relaxed);
+          });
+    }
+  } else if (cell_pairs) {
+    const std::vector<int> &cells = m_grid.populatedCells();
+    m_scheduler->parallelFor(
+        0, cells.size(), 64, [&](size_t start_idx, size_t end_idx) {
+          PROFILE_SCOPE("Contact Chunk");
+          uint64_t pairs = checkCollisionsForCellPairs(
+              m_particles, m_grid, cells, start_idx, end_idx,
+              m_constants, collision);
+          pair_tests.fetch_add(pairs, std::memory_order_relaxed);
+        });
+  } else {
+    m_scheduler->parallelFor(
+        0, m_particles.size(), 128,
+        [&](size_t start_idx, size_t end_idx) {
+          PROFILE_SCOPE("Contact Chunk");
+          uint64_t pairs = checkCollisionsForChunk(
+              m_particles, m_grid, start_idx, end_idx, m_constants);
+          pair_tests.fetch_add(pairs, std::memory_order_relaxed);
+        });
+  }
+  return pair_tests.load();
+}
+
+// The per-object walks see every pair from both sides. The pair is resolved
+// from the lower index, unless only one side is awake, since asleep objects
+// skip their walk.
+static bool ownsPair(const ParticleStore &particles, uint32_t i,
+                     uint32_t other_index) {
+  return i < other_index || particles.isAsleep(other_index);
+}
+
+void PhysicsWorld::buildNeighbourList() {
+  m_listCells.clear();
+  m_listColorStart.assign(1, 0);
+  if (m_constants.CONTACT_SOLVER == ContactSolver::CELL_COLORED) {
+    m_grid.buildColorBuckets(m_constants.USE_3D);
+    for (int color = 0;
+         color < SpatialGrid::colorCount(m_constants.USE_3D); ++color) {
+      const std::vector<int> &cells = m_grid.cellsOfColor(color);
+      m_listCells.insert(m_listCells.end(), cells.begin(), cells.end());
+      m_listColorStart.push_back(m_listCells.size());
+    }
+  } else {
+    m_listCells = m_grid.populatedCells();
+    m_listColorStart.push_back(m_listCells.size());
+  }
+  m_neighbourList.build(m_particles, m_grid, m_listCells,
+                        m_constants.NEIGHBOUR_SKIN, m_constants.USE_3D,
+                        *m_scheduler);
+  m_listSolver = m_constants.CONTACT_SOLVER;
+  m_listSkin = m_constants.NEIGHBOUR_SKIN;
+}
+
+// The list keeps the grid's cell ownership, so the cells of one colour can
+// still be resolved without locks.
+uint64_t PhysicsWorld::resolveListContacts() {
+  const bool colored = m_listSolver == ContactSolver::CELL_COLORED;
+  const CollisionResolver resolve = colored ? collisionUnlocked : collision;
+  for (size_t color = 0; color + 1 < m_listColorStart.size(); ++color) {
+    m_scheduler->parallelFor(
+        m_listColorStart[color], m_listColorStart[color + 1], 16,
+        [&](size_t start_idx, size_t end_idx) {
+          PROFILE_SCOPE("Contact Chunk");
+          for (size_t c = start_idx; c < end_idx; ++c) {
+            for (const NeighbourPair &pair : m_neighbourList.cellPairs(c)) {
+              resolve(m_particles, pair.i, pair.j, m_constants);
+            }
+          }
+        });
+  }
+  return m_neighbourList.pairCount();
+}
+
+uint64_t
+PhysicsWorld::checkCollisionsForChunk(ParticleStore &particles,
+                                      SpatialGrid &grid, size_t start_idx,
+                                      size_t end_idx,
+                                      const SimulationConstants &constants) {
+  uint64_t pairs = 0;
+  for (uint32_t i = start_idx; i < end_idx; ++i) {
+    if (particles.isAsleep(i)) {
+      continue;
+    }
+    grid.processPotentialColliders(
+        particles, i, constants.USE_3D, [&](uint32_t other_index) {
+          ++pairs;
+          if (ownsPair(particles, i, other_index)) {
+            collision(particles, i, other_index, constants);
+          }
+        });
+  }
+  return pairs;
+}
+
+uint64_t
+PhysicsWorld::checkCollisionsForCells(ParticleStore &particles,
+                                      SpatialGrid &grid,
+                                      const std::vector<int> &cells,
+                                      size_t start_idx, size_t end_idx,
+                                      const SimulationConstants &constants) {
+  uint64_t pairs = 0;
+  for (size_t c = start_idx; c < end_idx; ++c) {
+    for (uint32_t i : grid.cellObjects(cells[c])) {
+      if (particles.isAsleep(i)) {
+        continue;
+      }
+      // Other cells of this colour are resolved concurrently, so the walk
+      // must stay within this cell's stencil even if i has left the cell.
+      grid.processCellNeighbourhood(
+          cells[c], constants.USE_3D, [&](uint32_t other_index) {
+            assert(grid.areNeighbours(cells[c], grid.objectCell(other_index)));
+            ++pairs;
+            if (ownsPair(particles, i, other_index)) {
+              collisionUnlocked(particles, i, other_index, constants);
+            }
+          });
+    }
+  }
+  return pairs;
+}
+
+uint64_t PhysicsWorld::checkCollisionsForCellPairs(
+    ParticleStore &particles, SpatialGrid &grid,
+    const std::vector<int> &cells, size_t start_idx, size_t end_idx,
+    const SimulationConstants &constants, CollisionResolver resolve) {
+  if (constants.NARROW_PHASE == NarrowPhase::SIMD_BATCH) {
+    return checkCollisionsForCellBatches(particles, grid, cells, start_idx,
+                                         end_idx, constants, resolve);
+  }
+  uint64_t pairs = 0;
+  for (size_t c = start_idx; c < end_idx; ++c) {
+    if (constants.SLEEPING &&
+        !grid.hasAwakePairs(cells[c], constants.USE_3D)) {
+      continue;
+    }
+    pairs += grid.processCellPairs(
+        cells[c], constants.USE_3D, [&](uint32_t i, uint32_t j) {
+          resolve(particles, i, j, constants);
+        });
+  }
+  return pairs;
+}
+
+// Packs a cell's objects followed by those of its forward half stencil into
+// one batch, so object a of the cell is tested against entries a + 1 onwards.
+// This covers the same pairs as processCellPairs(), but the no-hit case is
+// decided by the vector kernel and only overlapping pairs are resolved.
+// Every resolve writes the pair's new positions back into the batch, and
+// once it has moved the query the rest of the batch is tested again, so no
+// test sees a position an earlier response has changed. The pairs are
+// still visited in another order than processCellPairs() visits them, so
+// the two paths agree only up to that ordering.
+uint64_t PhysicsWorld::checkCollisionsForCellBatches(
+    ParticleStore &particles, SpatialGrid &grid,
+    const std::vector<int> &cells, size_t start_idx, size_t end_idx,
+    const SimulationConstants &constants, CollisionResolver resolve) {
+  thread_local CandidateBatch batch;
+  thread_local std::vector<uint32_t> hits;
+  const OverlapKernel kernel = overlapKernel();
+  uint64_t pairs = 0;
+  for (size_t c = start_idx; c < end_idx; ++c) {
+    if (constants.SLEEPING &&
+        !grid.hasAwakePairs(cells[c], constants.USE_3D)) {
+      continue;
+    }
+    std::span<const uint32_t> own = grid.cellObjects(cells[c]);
+    batch.clear();
+    for (uint32_t i : own) {
+      batch.push(particles, i);
+    }
+    grid.forEachForwardNeighbour(
+        cells[c], constants.USE_3D, [&](std::span<const uint32_t> other) {
+          for (uint32_t j : other) {
+            batch.push(particles, j);
+          }
+        });
+    hits.resize(batch.size());
+
+    auto refresh = [&](size_t slot) {
+      const uint32_t i = batch.index[slot];
+      const bool moved = batch.x[slot] != particles.posX[i] ||
+                         batch.y[slot] != particles.posY[i] ||
+                         batch.z[slot] != particles.posZ[i];
+      batch.x[slot] = particles.posX[i];
+      batch.y[slot] = particles.posY[i];
+      batch.z[slot] = particles.posZ[i];
+      return moved;
+    };
+    for (size_t a = 0; a < own.size(); ++a) {
+      pairs += batch.size() - a - 1;
+      size_t next = a + 1;
+      while (next < batch.size()) {
+        size_t num_hits = kernel(batch.x[a], batch.y[a], batch.z[a],
+                                 batch.radius[a], batch, next, hits.data());
+        next = batch.size();
+        for (size_t h = 0; h < num_hits; ++h) {
+          resolve(particles, own[a], batch.index[hits[h]], constants);
+          refresh(hits[h]);
+          if (refresh(a)) {
+            next = hits[h] + 1;
+            break;
+          }
+        }
+      }
+    }
+  }
+  return pairs;
+}
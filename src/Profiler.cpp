@@ -0,0 +1,173 @@
+#include "../include/Profiler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <limits>
+
+thread_local uint32_t ProfileScope::s_depth = 0;
+
+Profiler &Profiler::get() {
+  static Profiler profiler;
+  return profiler;
+}
+
+uint64_t Profiler::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void Profiler::setEnabled(bool enabled) {
+  m_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+// Buffers are created on a thread's first recorded zone, so threads that
+// never record while the profiler is enabled cost nothing.
+static thread_local bool t_registered = false;
+static thread_local std::string t_threadName;
+
+Profiler::ThreadBuffer &Profiler::localBuffer() {
+  thread_local ThreadBuffer *buffer = nullptr;
+  if (!buffer) {
+    auto created = std::make_unique<ThreadBuffer>();
+    created->zones.resize(ZONES_PER_THREAD);
+    std::lock_guard<std::mutex> lock(m_threadsMutex);
+    created->id = static_cast<uint32_t>(m_threads.size());
+    created->name = t_threadName.empty()
+                        ? "Thread " + std::to_string(created->id)
+                        : t_threadName;
+    buffer = created.get();
+    m_threads.push_back(std::move(created));
+    t_registered = true;
+  }
+  return *buffer;
+}
+
+void Profiler::setThreadName(const std::string &name) {
+  t_threadName = name;
+  if (t_registered) {
+    ThreadBuffer &buffer = localBuffer();
+    std::lock_guard<std::mutex> lock(m_threadsMutex);
+    buffer.name = name;
+  }
+}
+
+void Profiler::markFrame() {
+  if (!isEnabled()) {
+    m_frameStart = 0;
+    return;
+  }
+  uint64_t time = now();
+  if (m_frameStart != 0) {
+    if (m_frames.size() < FRAME_HISTORY) {
+      m_frames.push_back({m_frameStart, time});
+    } else {
+      m_frames[m_frameCount % FRAME_HISTORY] = {m_frameStart, time};
+    }
+    ++m_frameCount;
+  }
+  m_frameStart = time;
+}
+
+void Profiler::record(const char *name, uint64_t startNs, uint64_t endNs,
+                      uint32_t depth) {
+  ThreadBuffer &buffer = localBuffer();
+  buffer.zones[buffer.head % ZONES_PER_THREAD] = {name, startNs, endNs,
+                                                  buffer.id, depth};
+  ++buffer.head;
+}
+
+std::vector<ProfileFrame> Profiler::frames() const {
+  std::vector<ProfileFrame> ordered;
+  ordered.reserve(m_frames.size());
+  size_t oldest = m_frames.size() < FRAME_HISTORY
+                      ? 0
+                      : m_frameCount % FRAME_HISTORY;
+  for (size_t i = 0; i < m_frames.size(); ++i) {
+    ordered.push_back(m_frames[(oldest + i) % m_frames.size()]);
+  }
+  return ordered;
+}
+
+// A thread records a zone when it ends, so each buffer is sorted by end
+// time and the backwards walk can stop at the first zone ending too early.
+std::vector<ProfileZone> Profiler::zones(uint64_t fromNs,
+                                         uint64_t toNs) const {
+  std::vector<ProfileZone> result;
+  std::lock_guard<std::mutex> lock(m_threadsMutex);
+  for (const std::unique_ptr<ThreadBuffer> &buffer : m_threads) {
+    uint64_t oldest =
+        buffer->head > ZONES_PER_THREAD ? buffer->head - ZONES_PER_THREAD : 0;
+    for (uint64_t k = buffer->head; k > oldest; --k) {
+      const ProfileZone &zone = buffer->zones[(k - 1) % ZONES_PER_THREAD];
+      if (zone.endNs < fromNs) {
+        break;
+      }
+      if (zone.startNs <= toNs) {
+        result.push_back(zone);
+      }
+    }
+  }
+  return result;
+}
+
+std::vector<std::string> Profiler::threadNames() const {
+  std::lock_guard<std::mutex> lock(m_threadsMutex);
+  std::vector<std::string> names;
+  for (const std::unique_ptr<ThreadBuffer> &buffer : m_threads) {
+    names.push_back(buffer->name);
+  }
+  return names;
+}
+
+static void writeJsonString(std::ostream &out, const std::string &text) {
+  out << '"';
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      out << '\\';
+    }
+    out << c;
+  }
+  out << '"';
+}
+
+// Writes every zone still held in the ring buffers in the Chrome trace event
+// format, which chrome://tracing and Perfetto can open.
+bool Profiler::writeChromeTrace(const std::string &path) const {
+  std::ofstream out(path);
+  if (!out) {
+    return false;
+  }
+  std::vector<ProfileZone> all =
+      zones(0, std::numeric_limits<uint64_t>::max());
+  std::vector<std::string> names = threadNames();
+  uint64_t base = std::numeric_limits<uint64_t>::max();
+  for (const ProfileZone &zone : all) {
+    base = std::min(base, zone.startNs);
+  }
+
+  out << "{\"traceEvents\":[";
+  bool first = true;
+  for (size_t t = 0; t < names.size(); ++t) {
+    out << (first ? "\n" : ",\n");
+    first = false;
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+        << ",\"args\":{\"name\":";
+    writeJsonString(out, names[t]);
+    out << "}}";
+  }
+  out.setf(std::ios::fixed);
+  out.precision(3);
+  for (const ProfileZone &zone : all) {
+    out << (first ? "\n" : ",\n");
+    first = false;
+    out << "{\"name\":";
+    writeJsonString(out, zone.name);
+    out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << zone.thread
+        << ",\"ts\":" << (zone.startNs - base) / 1000.0
+        << ",\"dur\":" << (zone.endNs - zone.startNs) / 1000.0 << "}";
+  }
+  out << "\n]}\n";
+  return static_cast<bool>(out);
+}
@@ -1,116 +1,237 @@
 #include "../include/Shader.hpp"
 
-Shader::Shader(const char *shaderPath, ShaderType type) {
-  std::string shaderCode;
-  std::ifstream sFile;
-  sFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+
+static std::string readFile(const char *path) {
+  std::ifstream file;
+  file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
   try {
-    sFile.open(shaderPath);
-    std::stringstream sStream;
-    sStream << sFile.rdbuf();
-    sFile.close();
-    shaderCode = sStream.str();
+    file.open(path);
+    std::stringstream stream;
+    stream << file.rdbuf();
+    file.close();
+    return stream.str();
   } catch (std::ifstream::failure &e) {
     std::cerr << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << e.what()
               << std::endl;
   }
-  const char *sCode = shaderCode.c_str();
+  return std::string();
+}
 
-  GLuint shader;
-  if (type == ShaderType::COMPUTE_SHADER) {
-    shader = glCreateShader(GL_COMPUTE_SHADER);
-    glShaderSource(shader, 1, &sCode, NULL);
-    glCompileShader(shader);
-    checkCompileErrors(shader, "COMPUTE");
+static void hashBytes(uint64_t &hash, const void *data, size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+}
 
-    ID = glCreateProgram();
-    glAttachShader(ID, shader);
-    glLinkProgram(ID);
-    checkCompileErrors(ID, "PROGRAM");
-    glDeleteShader(shader);
-  } else {
+static void hashString(uint64_t &hash, const char *string) {
+  // Also hashes the terminator so that adjacent strings stay apart.
+  hashBytes(hash, string, string ? std::strlen(string) + 1 : 0);
+}
+
+static const char *stageName(GLenum type) {
+  switch (type) {
+  case GL_VERTEX_SHADER:
+    return "VERTEX";
+  case GL_FRAGMENT_SHADER:
+    return "FRAGMENT";
+  default:
+    return "COMPUTE";
+  }
+}
+
+Shader::Shader(const char *shaderPath, ShaderType type) {
+  ID = 0;
+  if (type != ShaderType::COMPUTE_SHADER) {
     std::cerr << "ERROR: Shader constructor called with one path but not "
                  "COMPUTE_SHADER type."
               << std::endl;
+    return;
   }
+  build({{GL_COMPUTE_SHADER, readFile(shaderPath)}});
 }
 
 Shader::Shader(const char *vertexPath, const char *fragmentPath) {
-  std::string vertexCode;
-  std::string fragmentCode;
-  std::ifstream vShaderFile;
-  std::ifstream fShaderFile;
+  build({{GL_VERTEX_SHADER, readFile(vertexPath)},
+         {GL_FRAGMENT_SHADER, readFile(fragmentPath)}});
+}
 
-  vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-  fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-  try {
-    vShaderFile.open(vertexPath);
-    fShaderFile.open(fragmentPath);
-    std::stringstream vShaderStream, fShaderStream;
-    vShaderStream << vShaderFile.rdbuf();
-    fShaderStream << fShaderFile.rdbuf();
-    vShaderFile.close();
-    fShaderFile.close();
-    vertexCode = vShaderStream.str();
-    fragmentCode = fShaderStream.str();
-  } catch (std::ifstream::failure &e) {
-    std::cerr << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << e.what()
-              << std::endl;
+void Shader::build(const std::vector<Stage> &stages) {
+  ID = glCreateProgram();
+
+  GLint formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  std::string cachePath;
+  if (formats > 0) {
+    // FNV-1a over the driver and the sources: a driver update invalidates
+    // every binary, an edited shader only its own.
+    uint64_t hash = 14695981039346656037ull;
+    for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+      hashString(hash, reinterpret_cast<const char *>(glGetString(name)));
+    }
+    for (const Stage &stage : stages) {
+      hashBytes(hash, &stage.first, sizeof(stage.first));
+      hashString(hash, stage.second.c_str());
+    }
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin",
+                  static_cast<unsigned long long>(hash));
+    cachePath = std::string(SHADER_CACHE_DIR) + "/" + name;
+    if (loadBinary(cachePath)) {
+      m_fromCache = true;
+      cacheUniformLocations();
+      return;
+    }
+  }
+
+  std::vector<GLuint> shaders;
+  for (const Stage &stage : stages) {
+    const char *code = stage.second.c_str();
+    GLuint shader = glCreateShader(stage.first);
+    glShaderSource(shader, 1, &code, NULL);
+    glCompileShader(shader);
+    checkCompileErrors(shader, stageName(stage.first));
+    glAttachShader(ID, shader);
+    shaders.push_back(shader);
+  }
+  if (!cachePath.empty()) {
+    glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+  glLinkProgram(ID);
+  checkCompileErrors(ID, "PROGRAM");
+  for (GLuint shader : shaders) {
+    glDetachShader(ID, shader);
+    glDeleteShader(shader);
   }
-  const char *vShaderCode = vertexCode.c_str();
-  const char *fShaderCode = fragmentCode.c_str();
 
-  GLuint vertex, fragment;
+  GLint linked = GL_FALSE;
+  glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+  if (linked == GL_TRUE && !cachePath.empty()) {
+    saveBinary(cachePath);
+  }
+  cacheUniformLocations();
+}
 
-  vertex = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertex, 1, &vShaderCode, NULL);
-  glCompileShader(vertex);
-  checkCompileErrors(vertex, "VERTEX");
+bool Shader::loadBinary(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  GLenum format = 0;
+  if (!file.read(reinterpret_cast<char *>(&format), sizeof(format))) {
+    return false;
+  }
+  std::vector<char> binary((std::istreambuf_iterator<char>(file)),
+                           std::istreambuf_iterator<char>());
+  if (binary.empty()) {
+    return false;
+  }
+  glProgramBinary(ID, format, binary.data(),
+                  static_cast<GLsizei>(binary.size()));
+  GLint linked = GL_FALSE;
+  glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+  return linked == GL_TRUE;
+}
 
-  fragment = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragment, 1, &fShaderCode, NULL);
-  glCompileShader(fragment);
-  checkCompileErrors(fragment, "FRAGMENT");
+void Shader::saveBinary(const std::string &path) const {
+  GLint length = 0;
+  glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) {
+    return;
+  }
+  std::vector<char> binary(length);
+  GLenum format = 0;
+  glGetProgramBinary(ID, length, NULL, &format, binary.data());
 
-  ID = glCreateProgram();
-  glAttachShader(ID, vertex);
-  glAttachShader(ID, fragment);
-  glLinkProgram(ID);
-  checkCompileErrors(ID, "PROGRAM");
+  std::error_code error;
+  std::filesystem::create_directories(SHADER_CACHE_DIR, error);
+  // Written aside and renamed so that a crash never leaves half a binary.
+  const std::string partial = path + ".tmp";
+  {
+    std::ofstream file(partial, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(&format), sizeof(format));
+    file.write(binary.data(), length);
+    if (!file) {
+      std::cerr << "Could not write the shader cache file " << partial
+                << std::endl;
+      return;
+    }
+  }
+  std::filesystem::rename(partial, path, error);
+}
 
-  glDeleteShader(vertex);
-  glDeleteShader(fragment);
+void Shader::cacheUniformLocations() {
+  m_uniformLocations.clear();
+  GLint count = 0;
+  GLint maxLength = 0;
+  glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+  glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+  std::vector<GLchar> name(std::max(maxLength, 1));
+  for (GLint i = 0; i < count; ++i) {
+    GLsizei length = 0;
+    GLint size = 0;
+    GLenum type = 0;
+    glGetActiveUniform(ID, i, maxLength, &length, &size, &type, name.data());
+    std::string uniform(name.data(), length);
+    // Uniform block members have no location.
+    const GLint location = glGetUniformLocation(ID, uniform.c_str());
+    if (location < 0) {
+      continue;
+    }
+    // Arrays are reported as "name[0]" but may be set by plain name.
+    if (uniform.size() > 3 && uniform.ends_with("[0]")) {
+      m_uniformLocations.emplace(uniform.substr(0, uniform.size() - 3),
+                                 location);
+    }
+    m_uniformLocations.emplace(std::move(uniform), location);
+  }
+}
+
+GLint Shader::location(std::string_view name) const {
+  // Names the program does not use map to -1, which glUniform ignores.
+  auto it = m_uniformLocations.find(name);
+  return it != m_uniformLocations.end() ? it->second : -1;
 }
 
 void Shader::use() { glUseProgram(ID); }
 
-void Shader::setBool(const std::string &name, bool value) const {
-  glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+void Shader::setBool(std::string_view name, bool value) const {
+  glUniform1i(location(name), (int)value);
+}
+
+void Shader::setInt(std::string_view name, int value) const {
+  glUniform1i(location(name), value);
 }
 
-void Shader::setInt(const std::string &name, int value) const {
-  glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+void Shader::setFloat(std::string_view name, float value) const {
+  glUniform1f(location(name), value);
 }
 
-void Shader::setFloat(const std::string &name, float value) const {
-  glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+void Shader::setVec2(std::string_view name, const glm::vec2 &value) const {
+  glUniform2fv(location(name), 1, &value[0]);
 }
 
-void Shader::setVec2(const std::string &name, const glm::vec2 &value) const {
-  glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+void Shader::setVec3(std::string_view name, const glm::vec3 &value) const {
+  glUniform3fv(location(name), 1, &value[0]);
 }
 
-void Shader::setVec3(const std::string &name, const glm::vec3 &value) const {
-  glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+void Shader::setMat4(std::string_view name, const glm::mat4 &mat) const {
+  glUniformMatrix4fv(location(name), 1, GL_FALSE, &mat[0][0]);
 }
 
-void Shader::setMat4(const std::string &name, const glm::mat4 &mat) const {
-  glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE,
-                     &mat[0][0]);
+void Shader::setIVec2(std::string_view name, const glm::ivec2 &value) const {
+  glUniform2iv(location(name), 1, &value[0]);
 }
 
-void Shader::setIVec2(const std::string &name, const glm::ivec2 &value) const {
-  glUniform2iv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+void Shader::setIVec3(std::string_view name, const glm::ivec3 &value) const {
+  glUniform3iv(location(name), 1, &value[0]);
 }
 
 void Shader::checkCompileErrors(GLuint shader, std::string type) {
@@ -1,16 +1,11 @@
 #include "../include/Simulation.hpp"
+#include "../include/Profiler.hpp"
 #include "imgui.h"
 #include "imgui_impl_opengl3.h"
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <iostream>
-#include <map>
-
-struct GpuPhysicsObject {
-  glm::vec3 position;
-  float radius;
-  glm::vec3 color;
-  float reflectivity;
-};
 
 struct GpuPointLight {
   glm::vec3 position;
@@ -19,6 +14,27 @@ struct GpuPointLight {
   float padding;
 };
 
+// std140 block FrameUniforms in raytracer.comp; vec3s share their 16 bytes
+// with the scalar after them and bools are 4-byte ints.
+struct RaytracerFrameUniforms {
+  glm::mat4 viewInverse;
+  glm::mat4 projectionInverse;
+  glm::vec3 cameraPos;
+  int numObjects;
+  glm::vec3 worldBoundsMin;
+  int numLights;
+  glm::vec3 worldBoundsMax;
+  float cellSize;
+  glm::ivec3 gridDimensions;
+  int useBvh;
+  glm::ivec2 renderSize;
+  int anyHitShadows;
+  int checkerboard;
+  int checkerParity;
+  int padding[3];
+};
+static_assert(sizeof(RaytracerFrameUniforms) == 224);
+
 void checkGLErrors(const char *label) {
   GLenum err;
   while ((err = glGetError()) != GL_NO_ERROR) {
@@ -27,58 +43,40 @@ void checkGLErrors(const char *label) {
 }
 
 void Simulation::resizeGpuBuffers() {
-  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_objectSSBO);
-  glBufferData(GL_SHADER_STORAGE_BUFFER,
-               m_constants.NUM_OBJECTS * sizeof(GpuPhysicsObject), nullptr,
-               GL_DYNAMIC_DRAW);
-
   glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_lightSSBO);
   glBufferData(GL_SHADER_STORAGE_BUFFER,
                m_pointLights.size() * sizeof(GpuPointLight), nullptr,
                GL_DYNAMIC_DRAW);
-
-  float current_cell_size =
-      m_constants.USE_3D ? m_constants.CELL_SIZE_3D : m_constants.CELL_SIZE_2D;
-  int cellsX =
-      static_cast<int>(std::ceil(m_constants.WORLD_WIDTH / current_cell_size));
-  int cellsY =
-      static_cast<int>(std::ceil(m_constants.WORLD_HEIGHT / current_cell_size));
-  int cellsZ =
-      static_cast<int>(std::ceil(m_constants.WORLD_DEPTH / current_cell_size));
-  if (cellsX == 0)
-    cellsX = 1;
-  if (cellsY == 0)
-    cellsY = 1;
-  if (cellsZ == 0)
-    cellsZ = 1;
-
-  size_t total_grid_cells = static_cast<size_t>(cellsX * cellsY * cellsZ);
-
-  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_gridCellsSSBO);
-  glBufferData(GL_SHADER_STORAGE_BUFFER, total_grid_cells * sizeof(GpuGridCell),
-               nullptr, GL_DYNAMIC_DRAW);
-
-  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_objectIndicesSSBO);
-  glBufferData(GL_SHADER_STORAGE_BUFFER,
-               m_constants.NUM_OBJECTS * RESERVE_PER_CELL * 4 *
-                   sizeof(unsigned int),
-               nullptr, GL_DYNAMIC_DRAW);
-
   glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
+// Colour plus primary hit distance at the Scene view size, like the FBO.
+void Simulation::resizeHistoryTextures() {
+  glDeleteTextures(2, m_historyTextures);
+  glGenTextures(2, m_historyTextures);
+  for (GLuint texture : m_historyTextures) {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, m_currentDisplayW,
+                 m_currentDisplayH, 0, GL_RGBA, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  m_historyValid = false;
+}
+
 Simulation::Simulation()
     : m_camera(glm::vec3(m_constants.WORLD_WIDTH / 2.0f,
                          m_constants.WORLD_HEIGHT / 2.0f, 3000.0f),
                glm::vec3(0.0f, 1.0f, 0.0f), -90.0f, 0.0f, m_constants),
       m_window(1920, 1080, "Physics Engine", &m_camera, m_constants.USE_3D),
-      m_grid(m_constants.WORLD_WIDTH, m_constants.WORLD_HEIGHT,
-             m_constants.WORLD_DEPTH,
-             m_constants.USE_3D ? m_constants.CELL_SIZE_3D
-                                : m_constants.CELL_SIZE_2D),
+      m_world(m_constants, std::thread::hardware_concurrency()),
       m_fbo(0), m_fboTexture(0), m_rbo(0), m_currentDisplayW(1920),
-      m_currentDisplayH(1080), m_threadPool(std::make_unique<ThreadPool>(
-                                   std::thread::hardware_concurrency())) {
+      m_currentDisplayH(1080) {
+  Profiler::get().setThreadName("Main");
+  Profiler::get().setEnabled(true);
   m_gui.init(m_window.getGlfwWindow());
 
   m_raytracingComputeShader =
@@ -98,6 +96,23 @@ Simulation::Simulation()
               << std::endl;
   }
 
+  m_overlapGrid = std::make_unique<GpuOverlapGrid>();
+  if (!m_overlapGrid->isReady()) {
+    std::cerr << "The raytracer grid shaders failed to build." << std::endl;
+  }
+  m_bvh = std::make_unique<GpuBvh>();
+  if (!m_bvh->isReady()) {
+    std::cerr << "The raytracer BVH shaders failed to build." << std::endl;
+  }
+  m_temporalResolveShader = std::make_unique<Shader>(
+      "shaders/temporal_resolve.comp", ShaderType::COMPUTE_SHADER);
+  m_impostorRenderer = std::make_unique<ImpostorRenderer>();
+  if (!m_impostorRenderer->isReady()) {
+    std::cerr << "The impostor shaders failed to build." << std::endl;
+  }
+  m_accelTimer = std::make_unique<GpuTimer>();
+  m_raytraceTimer = std::make_unique<GpuTimer>();
+
   m_pointLights.push_back({glm::vec3(m_constants.WORLD_WIDTH / 2.0f,
                                      m_constants.WORLD_HEIGHT + 5000,
                                      m_constants.WORLD_DEPTH / 2.0f),
@@ -125,11 +140,14 @@ Simulation::Simulation()
   if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
     std::cerr << "Framebuffer incomplete!" << std::endl;
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  resizeHistoryTextures();
 
-  glGenBuffers(1, &m_objectSSBO);
   glGenBuffers(1, &m_lightSSBO);
-  glGenBuffers(1, &m_gridCellsSSBO);
-  glGenBuffers(1, &m_objectIndicesSSBO);
+  glGenBuffers(1, &m_frameUniformBuffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, m_frameUniformBuffer);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(RaytracerFrameUniforms), nullptr,
+               GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
   resizeGpuBuffers();
 
@@ -140,14 +158,14 @@ Simulation::~Simulation() {
   m_gui.shutdown();
   delete m_raytracingComputeShader;
 
-  glDeleteBuffers(1, &m_objectSSBO);
   glDeleteBuffers(1, &m_lightSSBO);
-  glDeleteBuffers(1, &m_gridCellsSSBO);
-  glDeleteBuffers(1, &m_objectIndicesSSBO);
+  glDeleteBuffers(1, &m_frameUniformBuffer);
 
   glDeleteFramebuffers(1, &m_fbo);
   glDeleteTextures(1, &m_fboTexture);
   glDeleteRenderbuffers(1, &m_rbo);
+  glDeleteTextures(2, m_historyTextures);
+  glDeleteProgram(m_temporalResolveShader->ID);
 }
 
 void Simulation::restart() {
@@ -160,197 +178,337 @@ void Simulation::notifyWorldDimensionsChanged() {
   m_pendingWorldResize = true;
 }
 
+size_t Simulation::objectCount() const {
+  if (m_activeDevice == PhysicsDevice::GPU) {
+    return m_gpuPhysics->objectCount();
+  }
+  return m_world.objectCount();
+}
+
+static constexpr float MIN_RENDER_SCALE = 0.25f;
+
+// Trace time grows with the pixel count, so with the square of the scale,
+// while the BVH or grid build and a GPU physics step do not depend on it.
+// Each frame the scale moves part of the way to the one that would have
+// met the target; the timers report a few frames late, and a full step
+// would overshoot.
+void Simulation::updateRenderScale() {
+  if (!m_constants.DYNAMIC_RESOLUTION) {
+    m_renderScale = std::clamp(m_constants.RENDER_SCALE, MIN_RENDER_SCALE,
+                               1.0f);
+    return;
+  }
+  const float traceMs = m_raytraceTimer->lastMs();
+  if (traceMs <= 0.0f) {
+    return;
+  }
+  float fixedMs = m_drawImpostors ? 0.0f : m_accelTimer->lastMs();
+  if (m_activeDevice == PhysicsDevice::GPU) {
+    fixedMs += m_gpuPhysics->stats().stepMs;
+  }
+  const float budgetMs = std::max(m_constants.TARGET_FRAME_MS - fixedMs,
+                                  0.1f * m_constants.TARGET_FRAME_MS);
+  const float idealScale =
+      std::clamp(m_renderScale * std::sqrt(budgetMs / traceMs),
+                 MIN_RENDER_SCALE, 1.0f);
+  m_renderScale += 0.1f * (idealScale - m_renderScale);
+}
+
+static constexpr int SLOW_TRACE_FRAMES = 30;
+
+// AUTO draws impostors from IMPOSTOR_OBJECT_THRESHOLD objects up, or once
+// the trace has stayed over IMPOSTOR_TRACE_MS for a while, which with
+// dynamic resolution on means even the lowest scale is too slow. The trace
+// time cannot be measured while rasterising, so the way back is by object
+// count only: a quarter below the count the switch happened at.
+void Simulation::updateScenePath() {
+  if (m_constants.SCENE_RENDERER != SceneRenderer::AUTO) {
+    m_drawImpostors = m_constants.SCENE_RENDERER == SceneRenderer::IMPOSTORS;
+    m_slowTraceFrames = 0;
+    return;
+  }
+
+  const size_t objects = objectCount();
+  const size_t threshold =
+      static_cast<size_t>(std::max(m_constants.IMPOSTOR_OBJECT_THRESHOLD, 1));
+  if (m_autoImpostors) {
+    if (objects < std::min(threshold, m_impostorSwitchCount * 3 / 4)) {
+      m_autoImpostors = false;
+    }
+  } else {
+    // Only frames that were actually traced count.
+    if (!m_drawImpostors &&
+        m_raytraceTimer->lastMs() > m_constants.IMPOSTOR_TRACE_MS) {
+      ++m_slowTraceFrames;
+    } else {
+      m_slowTraceFrames = 0;
+    }
+    if (objects >= threshold || m_slowTraceFrames >= SLOW_TRACE_FRAMES) {
+      m_autoImpostors = true;
+      m_impostorSwitchCount = objects;
+      m_slowTraceFrames = 0;
+    }
+  }
+  m_drawImpostors = m_autoImpostors;
+}
+
+PhysicsBackend &Simulation::physics() {
+  if (m_activeDevice == PhysicsDevice::GPU) {
+    return *m_gpuPhysics;
+  }
+  return m_world;
+}
+
+const PhysicsStats &Simulation::physicsStats() const {
+  if (m_activeDevice == PhysicsDevice::GPU) {
+    return m_gpuPhysics->stats();
+  }
+  return m_world.stats();
+}
+
+bool Simulation::createGpuPhysics() {
+  if (!m_gpuPhysics) {
+    m_gpuPhysics = std::make_unique<GpuPhysics>(m_constants);
+  }
+  if (!m_gpuPhysics->isReady()) {
+    std::cerr << "GPU physics shaders failed to build, staying on the CPU."
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Hands the particle state over when the device selected in the GUI
+// changes.
+void Simulation::syncPhysicsDevice() {
+  if (m_constants.PHYSICS_DEVICE == m_activeDevice) {
+    return;
+  }
+  if (m_constants.PHYSICS_DEVICE == PhysicsDevice::GPU) {
+    if (!createGpuPhysics()) {
+      m_constants.PHYSICS_DEVICE = PhysicsDevice::CPU;
+      return;
+    }
+    m_gpuPhysics->upload(m_world.particles());
+  } else {
+    m_gpuPhysics->download(m_world.particles());
+  }
+  m_activeDevice = m_constants.PHYSICS_DEVICE;
+}
+
+// One frame of contacts resolved in another order moves a settled scene by
+// about 2% of a radius rms, though single objects can move a whole radius.
+static constexpr float CROSS_CHECK_TOLERANCE = 0.05f;
+
+static double kineticEnergy(const ParticleStore &particles) {
+  double energy = 0.0;
+  for (size_t i = 0; i < particles.size(); ++i) {
+    glm::vec3 vel = particles.velocity(i);
+    energy += 0.5 * particles.mass(i) * glm::dot(vel, vel);
+  }
+  return energy;
+}
+
+// Steps one frame from the current state on both backends and compares the
+// results. The CPU runs the solver the GPU implements, but the GPU orders
+// each cell's objects by atomicAdd and so differently from run to run;
+// dense scenes drift apart a little, and the check passes while the rms
+// position error stays within CROSS_CHECK_TOLERANCE of the largest radius.
+// Each backend carries on from its own result.
+void Simulation::crossCheckBackends() {
+  if (!createGpuPhysics()) {
+    return;
+  }
+  if (m_activeDevice == PhysicsDevice::GPU) {
+    m_gpuPhysics->download(m_world.particles());
+  }
+  const ParticleStore start = m_world.particles();
+
+  // The GPU has no sleep state, so the CPU step runs with everything awake
+  // and the objects that were asleep go back to sleep where they were.
+  const ContactSolver solver = m_constants.CONTACT_SOLVER;
+  const Broadphase broadphase = m_constants.BROADPHASE;
+  const bool sleeping = m_constants.SLEEPING;
+  const bool adaptive = m_constants.ADAPTIVE_SUBSTEPS;
+  const bool reorder = m_constants.MORTON_REORDER;
+  const NarrowPhase narrow_phase = m_constants.NARROW_PHASE;
+  const bool incremental = m_constants.INCREMENTAL_GRID;
+  m_constants.CONTACT_SOLVER = ContactSolver::CELL_COLORED;
+  m_constants.BROADPHASE = Broadphase::CELL_PAIRS;
+  m_constants.SLEEPING = false;
+  // GpuPhysics always takes PHYSICS_ITERATIONS substeps.
+  m_constants.ADAPTIVE_SUBSTEPS = false;
+  // The results are compared index by index, so the order must stay put.
+  m_constants.MORTON_REORDER = false;
+  // Both change the order in which pairs are resolved.
+  m_constants.NARROW_PHASE = NarrowPhase::SCALAR;
+  m_constants.INCREMENTAL_GRID = false;
+  std::fill(m_world.particles().asleep.begin(),
+            m_world.particles().asleep.end(), 0);
+  m_world.step();
+  m_constants.CONTACT_SOLVER = solver;
+  m_constants.BROADPHASE = broadphase;
+  m_constants.SLEEPING = sleeping;
+  m_constants.ADAPTIVE_SUBSTEPS = adaptive;
+  m_constants.MORTON_REORDER = reorder;
+  m_constants.NARROW_PHASE = narrow_phase;
+  m_constants.INCREMENTAL_GRID = incremental;
+
+  m_gpuPhysics->upload(start);
+  auto gpu_start = std::chrono::high_resolution_clock::now();
+  m_gpuPhysics->step();
+  ParticleStore gpuResult;
+  m_gpuPhysics->download(gpuResult);
+  float gpu_ms = std::chrono::duration<float, std::milli>(
+                     std::chrono::high_resolution_clock::now() - gpu_start)
+                     .count();
+
+  const ParticleStore &cpuResult = m_world.particles();
+  BackendComparison comparison;
+  comparison.valid = true;
+  comparison.objects = cpuResult.size();
+  double error_sum = 0.0;
+  for (size_t i = 0; i < cpuResult.size(); ++i) {
+    float error = glm::length(cpuResult.position(i) - gpuResult.position(i));
+    comparison.maxPositionError = std::max(comparison.maxPositionError, error);
+    error_sum += static_cast<double>(error) * error;
+  }
+  if (!cpuResult.empty()) {
+    comparison.rmsPositionError =
+        static_cast<float>(std::sqrt(error_sum / cpuResult.size()));
+  }
+  comparison.cpuKineticEnergy = kineticEnergy(cpuResult);
+  comparison.gpuKineticEnergy = kineticEnergy(gpuResult);
+  comparison.cpuMs = m_world.stats().stepMs;
+  comparison.gpuMs = gpu_ms;
+  comparison.tolerance = CROSS_CHECK_TOLERANCE * m_maxObjectRadius;
+  comparison.withinTolerance =
+      comparison.rmsPositionError <= comparison.tolerance;
+  m_backendComparison = comparison;
+
+  ParticleStore &particles = m_world.particles();
+  for (size_t i = 0; i < particles.size(); ++i) {
+    if (start.asleep[i]) {
+      particles.setPosition(i, start.position(i));
+      particles.setVelocity(i, start.velocity(i));
+    }
+  }
+  particles.asleep = start.asleep;
+  particles.restTime = start.restTime;
+  m_world.countAwake();
+}
+
 void Simulation::run() {
   auto last_time = std::chrono::high_resolution_clock::now();
 
   while (!m_window.shouldClose()) {
+    Profiler::get().markFrame();
 
     auto current_time = std::chrono::high_resolution_clock::now();
     float frame_delta_time =
         std::chrono::duration<float>(current_time - last_time).count();
     last_time = current_time;
 
-    m_window.processInput(frame_delta_time);
+    {
+      PROFILE_SCOPE("Input");
+      m_window.processInput(frame_delta_time);
+    }
 
     if (m_pendingRestart) {
-      m_objects.clear();
-      for (int i = 0; i < m_constants.NUM_OBJECTS; ++i) {
-        m_objects.emplace_back(std::make_unique<PhysicsObject>(
-            m_constants, m_constants.USE_3D, m_constants.OBJECT_DEFAULT_RADIUS,
-            m_constants.OBJECT_DEFAULT_MASS));
+      m_world.restart();
+      const std::vector<float> &radii = m_world.particles().radius;
+      m_maxObjectRadius =
+          radii.empty() ? 0.0f : *std::max_element(radii.begin(), radii.end());
+      if (m_activeDevice == PhysicsDevice::GPU) {
+        m_gpuPhysics->upload(m_world.particles());
       }
       resizeGpuBuffers(); // Resize buffers after objects are repopulated
       m_pendingRestart = false;
     }
 
     if (m_pendingWorldResize) {
-      m_grid = SpatialGrid(m_constants.WORLD_WIDTH, m_constants.WORLD_HEIGHT,
-                           m_constants.WORLD_DEPTH,
-                           m_constants.USE_3D ? m_constants.CELL_SIZE_3D
-                                              : m_constants.CELL_SIZE_2D);
+      m_world.resizeWorld();
       resizeGpuBuffers(); // Resize buffers after grid is recreated
       m_pendingWorldResize = false;
     }
 
-    const float SUB_DELTA_TIME =
-        m_constants.FIXED_DELTA_TIME / m_constants.PHYSICS_ITERATIONS;
-    for (int iter = 0; iter < m_constants.PHYSICS_ITERATIONS; ++iter) {
-      for (auto &obj_ptr : m_objects) {
-        obj_ptr->update(SUB_DELTA_TIME);
-      }
-      m_grid.clear();
-      for (const auto &obj_ptr : m_objects) {
-        m_grid.insert(obj_ptr, m_constants.USE_3D);
-      }
-      std::vector<std::future<void>> futures;
-      size_t num_threads = m_threadPool->getNumThreads();
-      size_t chunk_size = m_objects.size() / num_threads;
-      if (chunk_size == 0 && m_objects.size() > 0) {
-        chunk_size = 1;
-      }
-      size_t current_start_idx = 0;
-      for (unsigned int t = 0;
-           t < num_threads && current_start_idx < m_objects.size(); ++t) {
-        size_t end_idx =
-            std::min(current_start_idx + chunk_size, m_objects.size());
-        if (t == num_threads - 1) {
-          end_idx = m_objects.size();
-        }
-        futures.emplace_back(m_threadPool->enqueue(
-            checkCollisionsForChunk, std::ref(m_objects), std::ref(m_grid),
-            current_start_idx, end_idx, m_constants));
-        current_start_idx = end_idx;
-      }
-      for (auto &f : futures) {
-        f.get();
-      }
+    syncPhysicsDevice();
+    if (m_pendingCrossCheck) {
+      crossCheckBackends();
+      m_pendingCrossCheck = false;
+    } else {
+      physics().step();
     }
 
     if (m_worldDimensionsChanged) {
       m_worldDimensionsChanged = false;
     }
 
-    std::vector<GpuPhysicsObject> shaderObjects(m_objects.size());
-    for (size_t i = 0; i < m_objects.size(); ++i) {
-      shaderObjects[i].position = m_objects[i]->position();
-      shaderObjects[i].radius = m_objects[i]->radius();
-      shaderObjects[i].color = m_objects[i]->color();
-      shaderObjects[i].reflectivity = 0.75f;
-    }
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_objectSSBO);
-    if (!shaderObjects.empty()) {
-      glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
-                      shaderObjects.size() * sizeof(GpuPhysicsObject),
-                      shaderObjects.data());
-    }
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_objectSSBO);
-
-    std::vector<GpuPointLight> shaderLights(m_pointLights.size());
-    for (size_t i = 0; i < m_pointLights.size(); ++i) {
-      shaderLights[i].position = m_pointLights[i].position;
-      shaderLights[i].intensity = m_pointLights[i].intensity;
-      shaderLights[i].color = m_pointLights[i].color;
-      shaderLights[i].padding = 0.0f;
-    }
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_lightSSBO);
-    if (!shaderLights.empty()) {
-      glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
-                      shaderLights.size() * sizeof(GpuPointLight),
-                      shaderLights.data());
-    }
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_lightSSBO);
-
-    int cellsX = static_cast<int>(
-        std::ceil(m_constants.WORLD_WIDTH / (m_constants.USE_3D
-                                                 ? m_constants.CELL_SIZE_3D
-                                                 : m_constants.CELL_SIZE_2D)));
-    int cellsY = static_cast<int>(
-        std::ceil(m_constants.WORLD_HEIGHT / (m_constants.USE_3D
-                                                  ? m_constants.CELL_SIZE_3D
-                                                  : m_constants.CELL_SIZE_2D)));
-    int cellsZ = static_cast<int>(
-        std::ceil(m_constants.WORLD_DEPTH / (m_constants.USE_3D
-                                                 ? m_constants.CELL_SIZE_3D
-                                                 : m_constants.CELL_SIZE_2D)));
-    if (cellsX == 0)
-      cellsX = 1;
-    if (cellsY == 0)
-      cellsY = 1;
-    if (cellsZ == 0)
-      cellsZ = 1;
-
-    std::map<int, std::vector<unsigned int>> cellObjectsMap;
-    float cellSize = m_constants.USE_3D ? m_constants.CELL_SIZE_3D
-                                        : m_constants.CELL_SIZE_2D;
-    for (size_t i = 0; i < m_objects.size(); ++i) {
-      const auto &obj = m_objects[i];
-      glm::vec3 min_bound = obj->position() - glm::vec3(obj->radius());
-      glm::vec3 max_bound = obj->position() + glm::vec3(obj->radius());
-      glm::ivec3 min_cell = glm::ivec3(floor(min_bound.x / cellSize),
-                                       floor(min_bound.y / cellSize),
-                                       floor(min_bound.z / cellSize));
-      glm::ivec3 max_cell = glm::ivec3(floor(max_bound.x / cellSize),
-                                       floor(max_bound.y / cellSize),
-                                       floor(max_bound.z / cellSize));
-      for (int x = min_cell.x; x <= max_cell.x; ++x) {
-        for (int y = min_cell.y; y <= max_cell.y; ++y) {
-          for (int z = (m_constants.USE_3D ? min_cell.z : 0);
-               z <= (m_constants.USE_3D ? max_cell.z : 0); ++z) {
-            glm::ivec3 cellCoords(x, y, z);
-            if (cellCoords.x >= 0 && cellCoords.x < cellsX &&
-                cellCoords.y >= 0 && cellCoords.y < cellsY &&
-                cellCoords.z >= 0 && cellCoords.z < cellsZ) {
-              int cellIndex = cellCoords.x + cellCoords.y * cellsX +
-                              cellCoords.z * cellsX * cellsY;
-              cellObjectsMap[cellIndex].push_back(i);
-            }
-          }
+    {
+      PROFILE_SCOPE("Object Upload");
+      if (m_activeDevice == PhysicsDevice::GPU) {
+        // The physics buffer already has the raytracer's layout.
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1,
+                         m_gpuPhysics->objectBuffer());
+      } else {
+        const ParticleStore &particles = m_world.particles();
+        auto *shaderObjects = static_cast<GpuPhysicsObject *>(
+            m_objectStream.map(particles.size() * sizeof(GpuPhysicsObject)));
+        if (shaderObjects) {
+          m_world.scheduler().parallelFor(
+              0, particles.size(), 0, [&](size_t start_idx, size_t end_idx) {
+                for (size_t i = start_idx; i < end_idx; ++i) {
+                  shaderObjects[i] = {particles.position(i),
+                                      particles.radius[i], particles.color[i],
+                                      0.75f};
+                }
+              });
         }
+        m_objectStream.commit(1);
       }
+
+      std::vector<GpuPointLight> shaderLights(m_pointLights.size());
+      for (size_t i = 0; i < m_pointLights.size(); ++i) {
+        shaderLights[i].position = m_pointLights[i].position;
+        shaderLights[i].intensity = m_pointLights[i].intensity;
+        shaderLights[i].color = m_pointLights[i].color;
+        shaderLights[i].padding = 0.0f;
+      }
+      glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_lightSSBO);
+      if (!shaderLights.empty()) {
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                        shaderLights.size() * sizeof(GpuPointLight),
+                        shaderLights.data());
+      }
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_lightSSBO);
     }
-    std::vector<GpuGridCell> gpuGridCells(cellsX * cellsY * cellsZ);
-    std::vector<unsigned int> gpuObjectIndices;
-    for (size_t i = 0; i < gpuGridCells.size(); ++i) {
-      gpuGridCells[i].objectStartIndex = gpuObjectIndices.size();
-      if (cellObjectsMap.count(i)) {
-        const auto &objectsInCell = cellObjectsMap.at(i);
-        gpuGridCells[i].objectCount = objectsInCell.size();
-        gpuObjectIndices.insert(gpuObjectIndices.end(), objectsInCell.begin(),
-                                objectsInCell.end());
+
+    updateScenePath();
+    if (!m_drawImpostors) {
+      m_accelTimer->begin();
+      if (m_constants.RAY_ACCELERATOR == RayAccelerator::BVH) {
+        m_bvh->build(objectCount(), m_constants);
       } else {
-        gpuGridCells[i].objectCount = 0;
+        m_overlapGrid->build(objectCount(), m_maxObjectRadius, m_constants);
       }
+      m_accelTimer->end();
     }
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_gridCellsSSBO);
-    if (!gpuGridCells.empty()) {
-      glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
-                      gpuGridCells.size() * sizeof(GpuGridCell),
-                      gpuGridCells.data());
-    } else {
-      glBufferData(GL_SHADER_STORAGE_BUFFER,
-                   gpuGridCells.size() * sizeof(GpuGridCell),
-                   gpuGridCells.data(), GL_DYNAMIC_DRAW);
-    }
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_gridCellsSSBO);
 
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_objectIndicesSSBO);
-    if (!gpuObjectIndices.empty()) {
-      glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
-                      gpuObjectIndices.size() * sizeof(unsigned int),
-                      gpuObjectIndices.data());
-    } else {
-      glBufferData(GL_SHADER_STORAGE_BUFFER,
-                   gpuObjectIndices.size() * sizeof(unsigned int),
-                   gpuObjectIndices.data(), GL_DYNAMIC_DRAW);
-    }
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_objectIndicesSSBO);
+    updateRenderScale();
 
     int prev_display_w = m_currentDisplayW;
     int prev_display_h = m_currentDisplayH;
 
-    m_gui.render(*this, m_fboTexture, m_currentDisplayW, m_currentDisplayH);
+    {
+      PROFILE_SCOPE("ImGui");
+      m_gui.render(*this, m_fboTexture, m_currentDisplayW, m_currentDisplayH);
+    }
 
     if (m_currentDisplayW <= 0 || m_currentDisplayH <= 0) {
+      // The structure build above has already read this frame's objects.
+      if (m_activeDevice == PhysicsDevice::CPU) {
+        m_objectStream.fence();
+      }
       m_window.swapBuffersAndPollEvents();
       continue;
     }
@@ -383,13 +541,22 @@ void Simulation::run() {
       if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
         std::cerr << "Framebuffer incomplete after resize!" << std::endl;
       glBindFramebuffer(GL_FRAMEBUFFER, 0);
+      resizeHistoryTextures();
     }
 
     glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
     glViewport(0, 0, m_currentDisplayW, m_currentDisplayH);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    m_raytracingComputeShader->use();
+    // The texture stays at the view size; only its lower-left corner is
+    // drawn and the GUI stretches that part over the view.
+    const glm::ivec2 renderSize(
+        std::max(static_cast<int>(std::lround(m_currentDisplayW *
+                                              m_renderScale)),
+                 1),
+        std::max(static_cast<int>(std::lround(m_currentDisplayH *
+                                              m_renderScale)),
+                 1));
 
     glm::vec3 physicsCenter(m_constants.WORLD_WIDTH / 2.0f,
                             m_constants.WORLD_HEIGHT / 2.0f,
@@ -401,63 +568,108 @@ void Simulation::run() {
     glm::vec3 worldBoundsMin = physicsCenter - renderHalfSize;
     glm::vec3 worldBoundsMax = physicsCenter + renderHalfSize;
 
-    m_raytracingComputeShader->setVec3("cameraPos", m_camera.Position);
-    m_raytracingComputeShader->setMat4("viewInverse",
-                                       glm::inverse(m_camera.getViewMatrix()));
-    m_raytracingComputeShader->setMat4(
-        "projectionInverse",
-        glm::inverse(m_camera.getProjectionMatrix((float)m_currentDisplayW /
-                                                  (float)m_currentDisplayH)));
-    m_raytracingComputeShader->setInt("numObjects", m_objects.size());
-    m_raytracingComputeShader->setInt("numLights", m_pointLights.size());
-    m_raytracingComputeShader->setVec3("worldBoundsMin", worldBoundsMin);
-    m_raytracingComputeShader->setVec3("worldBoundsMax", worldBoundsMax);
-    m_raytracingComputeShader->setVec3("physicsBoundsMin", glm::vec3(0.0f));
-    m_raytracingComputeShader->setVec3("physicsBoundsMax",
-                                       glm::vec3(m_constants.WORLD_WIDTH,
-                                                 m_constants.WORLD_HEIGHT,
-                                                 m_constants.WORLD_DEPTH));
-    m_raytracingComputeShader->setInt("gridCellsX", cellsX);
-    m_raytracingComputeShader->setInt("gridCellsY", cellsY);
-    m_raytracingComputeShader->setInt("gridCellsZ", cellsZ);
-    m_raytracingComputeShader->setFloat("cellSize", cellSize);
-    m_raytracingComputeShader->setInt("frameRandSeed", glfwGetTime() * 1000.0);
-    m_raytracingComputeShader->setFloat("floorGlossiness", 0.7f);
-
-    glBindImageTexture(0, m_fboTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY,
-                       GL_RGBA8);
-    glDispatchCompute((GLuint)std::ceil((float)m_currentDisplayW / 8.0f),
-                      (GLuint)std::ceil((float)m_currentDisplayH / 8.0f), 1);
-
-    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    const glm::mat4 view = m_camera.getViewMatrix();
+    const glm::mat4 projection = m_camera.getProjectionMatrix(
+        (float)m_currentDisplayW / (float)m_currentDisplayH);
+
+    if (m_drawImpostors) {
+      m_raytraceTimer->begin();
+      glViewport(0, 0, renderSize.x, renderSize.y);
+      m_impostorRenderer->render(objectCount(), m_pointLights.size(), view,
+                                 projection, m_camera.Position,
+                                 worldBoundsMin, worldBoundsMax);
+      m_raytraceTimer->end();
+      m_historyValid = false;
+    } else {
+      // CPU side only: the dispatch itself runs asynchronously on the GPU.
+      PROFILE_SCOPE("Raytrace Dispatch");
+      m_raytracingComputeShader->use();
+      const glm::mat4 viewInverse = glm::inverse(view);
+      const glm::mat4 projectionInverse = glm::inverse(projection);
+      const bool checkerboard = m_constants.CHECKERBOARD_TRACING;
+      const int checkerParity = static_cast<int>(m_frameIndex & 1);
+      const GLuint currentFrame = m_historyTextures[checkerParity];
+      const GLuint historyFrame = m_historyTextures[checkerParity ^ 1];
+
+      RaytracerFrameUniforms frame = {};
+      frame.viewInverse = viewInverse;
+      frame.projectionInverse = projectionInverse;
+      frame.cameraPos = m_camera.Position;
+      frame.numObjects = static_cast<int>(objectCount());
+      frame.worldBoundsMin = worldBoundsMin;
+      frame.numLights = static_cast<int>(m_pointLights.size());
+      frame.worldBoundsMax = worldBoundsMax;
+      frame.cellSize = m_overlapGrid->cellSize();
+      frame.gridDimensions = m_overlapGrid->dimensions();
+      frame.useBvh = m_constants.RAY_ACCELERATOR == RayAccelerator::BVH;
+      frame.renderSize = renderSize;
+      frame.anyHitShadows = m_constants.ANY_HIT_SHADOWS;
+      frame.checkerboard = checkerboard;
+      frame.checkerParity = checkerParity;
+      glBindBuffer(GL_UNIFORM_BUFFER, m_frameUniformBuffer);
+      glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frame), &frame);
+      glBindBuffer(GL_UNIFORM_BUFFER, 0);
+      glBindBufferBase(GL_UNIFORM_BUFFER, 0, m_frameUniformBuffer);
+
+      glBindImageTexture(0, m_fboTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY,
+                         GL_RGBA8);
+      m_raytraceTimer->begin();
+      if (checkerboard) {
+        glBindImageTexture(1, currentFrame, 0, GL_FALSE, 0, GL_READ_WRITE,
+                           GL_RGBA16F);
+        glDispatchCompute((GLuint)std::ceil((float)renderSize.x / 16.0f),
+                          (GLuint)std::ceil((float)renderSize.y / 8.0f), 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+        m_temporalResolveShader->use();
+        m_temporalResolveShader->setVec3("prevCameraPos", m_prevCameraPos);
+        m_temporalResolveShader->setMat4("prevViewProjection",
+                                         m_prevViewProjection);
+        m_temporalResolveShader->setIVec2("prevRenderSize", m_prevRenderSize);
+        m_temporalResolveShader->setBool("historyValid", m_historyValid);
+        m_temporalResolveShader->setInt("historyFrame", 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, historyFrame);
+        glDispatchCompute((GLuint)std::ceil((float)renderSize.x / 8.0f),
+                          (GLuint)std::ceil((float)renderSize.y / 8.0f), 1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+      } else {
+        glDispatchCompute((GLuint)std::ceil((float)renderSize.x / 8.0f),
+                          (GLuint)std::ceil((float)renderSize.y / 8.0f), 1);
+      }
+      m_raytraceTimer->end();
+
+      m_historyValid = checkerboard;
+      // Kept un-inverted: inverting the inverses again in float moves the
+      // reprojected pixels by a fraction of a texel.
+      m_prevViewProjection = projection * view;
+      m_prevCameraPos = m_camera.Position;
+      m_prevRenderSize = renderSize;
+      ++m_frameIndex;
+
+      glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT |
+                      GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
+    if (m_activeDevice == PhysicsDevice::CPU) {
+      m_objectStream.fence();
+    }
 
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-    ImGuiIO &io = ImGui::GetIO();
-    if (io.ConfigFlags & ImGuiConfigFlags_ViewportsEnable) {
-      GLFWwindow *backup_current_context = glfwGetCurrentContext();
-      ImGui::UpdatePlatformWindows();
-      ImGui::RenderPlatformWindowsDefault();
-      glfwMakeContextCurrent(backup_current_context);
-    }
-
-    m_window.swapBuffersAndPollEvents();
-  }
-}
+    {
+      PROFILE_SCOPE("Present");
+      ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+      ImGuiIO &io = ImGui::GetIO();
+      if (io.ConfigFlags & ImGuiConfigFlags_ViewportsEnable) {
+        GLFWwindow *backup_current_context = glfwGetCurrentContext();
+        ImGui::UpdatePlatformWindows();
+        ImGui::RenderPlatformWindowsDefault();
+        glfwMakeContextCurrent(backup_current_context);
+      }
 
-void Simulation::checkCollisionsForChunk(
-    const std::vector<std::unique_ptr<PhysicsObject>> &objects,
-    SpatialGrid &grid, size_t start_idx, size_t end_idx,
-    const SimulationConstants &constants) {
-  for (size_t i = start_idx; i < end_idx; ++i) {
-    grid.processPotentialColliders(
-        objects[i], constants.USE_3D, [&](PhysicsObject *other_object) {
-          if (objects[i].get() < other_object) {
-            collision(*objects[i], *other_object, constants);
-          }
-        });
+      m_window.swapBuffersAndPollEvents();
+    }
   }
 }
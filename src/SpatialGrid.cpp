@@ -1,5 +1,9 @@
 #include "../include/SpatialGrid.hpp"
+#include "../include/Profiler.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cmath>
 #include <iostream>
 
@@ -17,51 +21,500 @@ SpatialGrid::SpatialGrid(float width, float height, float depth, float cellSize)
     m_cellsZ = 1;
 
   size_t totalCells = static_cast<size_t>(m_cellsX * m_cellsY * m_cellsZ);
-  m_grid.resize(totalCells);
+  m_cellStart.resize(totalCells + 1, 0);
+  m_cellEnd.resize(totalCells, 0);
+  m_cellCount.resize(totalCells, 0);
   m_isCellDirty.resize(totalCells, false);
-
-  for (size_t i = 0; i < totalCells; ++i) {
-    m_grid[i].reserve(RESERVE_PER_CELL);
-  }
+  m_cellAwakeStamp.resize(totalCells, 0);
 }
 
-glm::ivec3 SpatialGrid::getCellCoords(const glm::vec3 &pos) {
+glm::ivec3 SpatialGrid::getCellCoords(const glm::vec3 &pos) const {
   int cellX = static_cast<int>(pos.x / m_cellSize);
   int cellY = static_cast<int>(pos.y / m_cellSize);
   int cellZ = static_cast<int>(pos.z / m_cellSize);
   return glm::ivec3(cellX, cellY, cellZ);
 }
 
-int SpatialGrid::get1DIndex(const glm::ivec3 &coords) {
+glm::ivec3 SpatialGrid::getCellCoords(int cell) const {
+  const int cellsPerLayer = m_cellsX * m_cellsY;
+  return glm::ivec3(cell % m_cellsX, (cell % cellsPerLayer) / m_cellsX,
+                    cell / cellsPerLayer);
+}
+
+int SpatialGrid::get1DIndex(const glm::ivec3 &coords) const {
   return coords.x + coords.y * m_cellsX + coords.z * m_cellsX * m_cellsY;
 }
 
-bool SpatialGrid::isValidCell(const glm::ivec3 &coords) {
+bool SpatialGrid::isValidCell(const glm::ivec3 &coords) const {
   return coords.x >= 0 && coords.x < m_cellsX && coords.y >= 0 &&
          coords.y < m_cellsY && coords.z >= 0 && coords.z < m_cellsZ;
 }
 
-void SpatialGrid::insert(const std::unique_ptr<PhysicsObject> &object,
-                         bool is3D) {
-  glm::ivec3 coords = getCellCoords(object->position());
+bool SpatialGrid::areNeighbours(int a, int b) const {
+  if (a < 0 || b < 0) {
+    return false;
+  }
+  glm::ivec3 offset = getCellCoords(a) - getCellCoords(b);
+  return std::abs(offset.x) <= 1 && std::abs(offset.y) <= 1 &&
+         std::abs(offset.z) <= 1;
+}
+
+int SpatialGrid::cellIndex(const glm::vec3 &pos, bool is3D) const {
+  glm::ivec3 coords = getCellCoords(pos);
   if (!is3D) {
     coords.z = 0;
   }
+  return isValidCell(coords) ? get1DIndex(coords) : -1;
+}
+
+// Spreads the low 21 bits of v out to every third bit.
+static uint64_t spreadBits3(uint64_t v) {
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffffull;
+  v = (v | v << 16) & 0x1f0000ff0000ffull;
+  v = (v | v << 8) & 0x100f00f00f00f00full;
+  v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+  v = (v | v << 2) & 0x1249249249249249ull;
+  return v;
+}
+
+// Spreads the low 32 bits of v out to every second bit.
+static uint64_t spreadBits2(uint64_t v) {
+  v &= 0xffffffff;
+  v = (v | v << 16) & 0x0000ffff0000ffffull;
+  v = (v | v << 8) & 0x00ff00ff00ff00ffull;
+  v = (v | v << 4) & 0x0f0f0f0f0f0f0f0full;
+  v = (v | v << 2) & 0x3333333333333333ull;
+  v = (v | v << 1) & 0x5555555555555555ull;
+  return v;
+}
+
+uint64_t SpatialGrid::mortonKey(const glm::vec3 &pos, bool is3D) const {
+  glm::ivec3 coords = glm::clamp(getCellCoords(pos), glm::ivec3(0),
+                                 glm::ivec3(m_cellsX - 1, m_cellsY - 1,
+                                            m_cellsZ - 1));
+  if (!is3D) {
+    return spreadBits2(coords.x) | spreadBits2(coords.y) << 1;
+  }
+  return spreadBits3(coords.x) | spreadBits3(coords.y) << 1 |
+         spreadBits3(coords.z) << 2;
+}
+
+int SpatialGrid::mortonBits(bool is3D) const {
+  const int largest = std::max({m_cellsX, m_cellsY, is3D ? m_cellsZ : 1});
+  return (is3D ? 3 : 2) *
+         std::bit_width(static_cast<unsigned int>(largest - 1));
+}
+
+void SpatialGrid::nextStamp() {
+  if (++m_rebuildStamp == 0) {
+    std::fill(m_cellAwakeStamp.begin(), m_cellAwakeStamp.end(), 0);
+    m_rebuildStamp = 1;
+  }
+}
+
+void SpatialGrid::markAwake(int cell) {
+  std::atomic_ref<uint32_t> stamp(m_cellAwakeStamp[cell]);
+  if (stamp.load(std::memory_order_relaxed) != m_rebuildStamp) {
+    stamp.store(m_rebuildStamp, std::memory_order_relaxed);
+  }
+}
 
-  if (isValidCell(coords)) {
-    int index = get1DIndex(coords);
-    if (m_isCellDirty[index] == 0) {
-      m_isCellDirty[index] = 1;
-      m_dirtyCellIndices.push_back(index);
+// Counting sort in three parallel passes: a per-cell histogram, a blocked
+// exclusive prefix sum over the cells and a scatter of the particle indices.
+// The scatter counts every histogram bucket back down to zero, so the next
+// rebuild starts from a clean histogram without an extra clearing pass.
+void SpatialGrid::rebuild(const ParticleStore &particles, bool is3D,
+                          TaskScheduler &scheduler) {
+  beginRebuild(particles.size());
+  scheduler.parallelFor(0, particles.size(), 0,
+                        [&](size_t start_idx, size_t end_idx) {
+                          binObjects(particles, is3D, start_idx, end_idx);
+                        });
+  finishRebuild(scheduler);
+}
+
+void SpatialGrid::beginRebuild(size_t numObjects) {
+  m_objectCell.resize(numObjects);
+  nextStamp();
+}
+
+void SpatialGrid::binObjects(const ParticleStore &particles, bool is3D,
+                             size_t start_idx, size_t end_idx) {
+  for (size_t i = start_idx; i < end_idx; ++i) {
+    int cell = cellIndex(particles.position(i), is3D);
+    m_objectCell[i] = cell;
+    if (cell < 0) {
+      continue;
+    }
+    std::atomic_ref<uint32_t>(m_cellCount[cell])
+        .fetch_add(1, std::memory_order_relaxed);
+    if (!particles.asleep[i]) {
+      markAwake(cell);
     }
-    m_grid[index].push_back(object.get());
   }
 }
 
-void SpatialGrid::clear() {
-  for (int index : m_dirtyCellIndices) {
-    m_grid[index].clear();
-    m_isCellDirty[index] = 0;
+void SpatialGrid::finishRebuild(TaskScheduler &scheduler) {
+  PROFILE_SCOPE("Grid Scan + Scatter");
+  const size_t numObjects = m_objectCell.size();
+  const size_t totalCells = m_cellCount.size();
+  const size_t numBlocks =
+      std::min(totalCells, scheduler.getNumThreads() * static_cast<size_t>(4));
+  m_blockOffsets.assign(numBlocks + 1, 0);
+  m_blockPopulated.assign(numBlocks + 1, 0);
+  auto blockBegin = [&](size_t block) {
+    return block * totalCells / numBlocks;
+  };
+
+  scheduler.parallelFor(0, numBlocks, 1, [&](size_t start_idx, size_t end_idx) {
+    for (size_t b = start_idx; b < end_idx; ++b) {
+      uint32_t sum = 0;
+      uint32_t populated = 0;
+      for (size_t c = blockBegin(b); c < blockBegin(b + 1); ++c) {
+        sum += m_cellCount[c] + m_updateSlack;
+        populated += m_cellCount[c] != 0;
+      }
+      m_blockOffsets[b + 1] = sum;
+      m_blockPopulated[b + 1] = populated;
+    }
+  });
+  for (size_t b = 0; b < numBlocks; ++b) {
+    m_blockOffsets[b + 1] += m_blockOffsets[b];
+    m_blockPopulated[b + 1] += m_blockPopulated[b];
+  }
+
+  m_dirtyCellIndices.resize(m_blockPopulated[numBlocks]);
+  scheduler.parallelFor(0, numBlocks, 1, [&](size_t start_idx, size_t end_idx) {
+    for (size_t b = start_idx; b < end_idx; ++b) {
+      uint32_t offset = m_blockOffsets[b];
+      uint32_t populated = m_blockPopulated[b];
+      for (size_t c = blockBegin(b); c < blockBegin(b + 1); ++c) {
+        m_cellStart[c] = offset;
+        m_cellEnd[c] = offset + m_cellCount[c];
+        offset += m_cellCount[c] + m_updateSlack;
+        m_isCellDirty[c] = m_cellCount[c] != 0;
+        if (m_isCellDirty[c]) {
+          m_dirtyCellIndices[populated++] = static_cast<int>(c);
+        }
+      }
+    }
+  });
+  m_cellStart[totalCells] = m_blockOffsets[numBlocks];
+
+  m_sortedIndices.resize(m_blockOffsets[numBlocks]);
+  scheduler.parallelFor(0, numObjects, 0, [&](size_t start_idx,
+                                               size_t end_idx) {
+    for (size_t i = start_idx; i < end_idx; ++i) {
+      int cell = m_objectCell[i];
+      if (cell < 0) {
+        continue;
+      }
+      uint32_t slot = std::atomic_ref<uint32_t>(m_cellCount[cell])
+                          .fetch_sub(1, std::memory_order_relaxed) -
+                      1;
+      m_sortedIndices[m_cellStart[cell] + slot] = static_cast<uint32_t>(i);
+    }
+  });
+  m_numCellBlocks = numBlocks;
+  m_built = true;
+}
+
+void SpatialGrid::update(const ParticleStore &particles, bool is3D,
+                         TaskScheduler &scheduler) {
+  if (!beginUpdate(particles.size(), scheduler)) {
+    rebuild(particles, is3D, scheduler);
+    return;
+  }
+  scheduler.parallelFor(0, m_numObjectBlocks, 1,
+                        [&](size_t start_idx, size_t end_idx) {
+                          for (size_t b = start_idx; b < end_idx; ++b) {
+                            findMoves(particles, is3D, b);
+                          }
+                        });
+  finishUpdate(particles, is3D, scheduler);
+}
+
+bool SpatialGrid::beginUpdate(size_t numObjects, TaskScheduler &scheduler) {
+  if (!m_built || numObjects == 0 || numObjects != m_objectCell.size()) {
+    return false;
+  }
+  m_numObjectBlocks =
+      std::min(numObjects, scheduler.getNumThreads() * static_cast<size_t>(4));
+  m_moveBatches.resize(m_numObjectBlocks * m_numCellBlocks);
+  m_blockMoves.resize(m_numObjectBlocks);
+  m_cellBlocks.resize(m_numCellBlocks);
+  nextStamp();
+  return true;
+}
+
+void SpatialGrid::findMoves(const ParticleStore &particles, bool is3D,
+                            size_t block) {
+  std::vector<Move> *batches = &m_moveBatches[block * m_numCellBlocks];
+  for (size_t b = 0; b < m_numCellBlocks; ++b) {
+    batches[b].clear();
+  }
+  auto [start_idx, end_idx] = updateBlock(block);
+  uint32_t moves = 0;
+  for (size_t i = start_idx; i < end_idx; ++i) {
+    int cell = cellIndex(particles.position(i), is3D);
+    if (cell >= 0 && !particles.asleep[i]) {
+      markAwake(cell);
+    }
+    int from = m_objectCell[i];
+    if (cell == from) {
+      continue;
+    }
+    m_objectCell[i] = cell;
+    ++moves;
+    Move move{static_cast<uint32_t>(i), from, cell};
+    size_t from_block = from < 0 ? m_numCellBlocks : cellBlockOf(from);
+    if (from >= 0) {
+      batches[from_block].push_back(move);
+    }
+    if (cell >= 0 && cellBlockOf(cell) != from_block) {
+      batches[cellBlockOf(cell)].push_back(move);
+    }
+  }
+  m_blockMoves[block] = moves;
+}
+
+// Past this share of moved particles a counting sort is cheaper than
+// patching the cells one particle at a time.
+static constexpr size_t UPDATE_MAX_MOVED_FRACTION = 8;
+
+void SpatialGrid::finishUpdate(const ParticleStore &particles, bool is3D,
+                               TaskScheduler &scheduler) {
+  PROFILE_SCOPE("Grid Update");
+  size_t moves = 0;
+  for (uint32_t block_moves : m_blockMoves) {
+    moves += block_moves;
+  }
+  if (moves == 0) {
+    return;
+  }
+  if (moves > m_objectCell.size() / UPDATE_MAX_MOVED_FRACTION) {
+    rebuild(particles, is3D, scheduler);
+    return;
+  }
+
+  scheduler.parallelFor(0, m_numCellBlocks, 1,
+                        [&](size_t start_idx, size_t end_idx) {
+                          for (size_t b = start_idx; b < end_idx; ++b) {
+                            applyMoves(b);
+                          }
+                        });
+  bool populated_changed = false;
+  for (const CellBlock &block : m_cellBlocks) {
+    if (block.overflow) {
+      // The cells are half patched, but a rebuild starts from the particles.
+      rebuild(particles, is3D, scheduler);
+      return;
+    }
+    populated_changed |= block.populatedChanged;
+  }
+  if (populated_changed) {
+    updatePopulatedCells(scheduler);
+  }
+}
+
+// Removals go first so that a cell can reuse the slots its leavers freed.
+// A cell's populated flag is still the one from before the update while the
+// insertions run, so a cell that is filled again after being emptied is not
+// mistaken for a newly populated one.
+void SpatialGrid::applyMoves(size_t cellBlock) {
+  CellBlock &block = m_cellBlocks[cellBlock];
+  block.newCells.clear();
+  block.populatedChanged = false;
+  block.overflow = false;
+  auto forEachMove = [&](auto &&fn) {
+    for (size_t b = 0; b < m_numObjectBlocks; ++b) {
+      for (const Move &move :
+           m_moveBatches[b * m_numCellBlocks + cellBlock]) {
+        fn(move);
+      }
+    }
+  };
+  auto owns = [&](int cell) {
+    return cell >= 0 && cellBlockOf(cell) == cellBlock;
+  };
+
+  forEachMove([&](const Move &move) {
+    if (!owns(move.from)) {
+      return;
+    }
+    uint32_t last = --m_cellEnd[move.from];
+    uint32_t k = m_cellStart[move.from];
+    while (m_sortedIndices[k] != move.index) {
+      ++k;
+    }
+    m_sortedIndices[k] = m_sortedIndices[last];
+  });
+
+  // The histogram is zero between rebuilds, so it can count the arrivals
+  // as long as it is counted back down.
+  bool fits = true;
+  forEachMove([&](const Move &move) {
+    if (owns(move.to)) {
+      fits &= m_cellEnd[move.to] + ++m_cellCount[move.to] <=
+              m_cellStart[move.to + 1];
+    }
+  });
+  if (!fits && !repackCellBlock(cellBlock)) {
+    block.overflow = true;
+    forEachMove([&](const Move &move) {
+      if (owns(move.to)) {
+        m_cellCount[move.to] = 0;
+      }
+    });
+    return;
+  }
+  forEachMove([&](const Move &move) {
+    if (!owns(move.to)) {
+      return;
+    }
+    --m_cellCount[move.to];
+    if (!m_isCellDirty[move.to]) {
+      m_isCellDirty[move.to] = true;
+      block.newCells.push_back(move.to);
+      block.populatedChanged = true;
+    }
+    m_sortedIndices[m_cellEnd[move.to]++] = move.index;
+  });
+  forEachMove([&](const Move &move) {
+    if (owns(move.from) &&
+        m_cellEnd[move.from] == m_cellStart[move.from]) {
+      m_isCellDirty[move.from] = false;
+      block.populatedChanged = true;
+    }
+  });
+}
+
+// Lays the cells of one block out again within the block's own slots, each
+// with room for its pending arrivals in m_cellCount and an even share of the
+// block's free slots. The block's outer bounds stay put, so the other
+// blocks are not affected. Fails if the block as a whole is full.
+bool SpatialGrid::repackCellBlock(size_t cellBlock) {
+  const size_t begin = cellBlockBegin(cellBlock);
+  const size_t end = cellBlockBegin(cellBlock + 1);
+  uint32_t needed = 0;
+  for (size_t c = begin; c < end; ++c) {
+    needed += m_cellEnd[c] - m_cellStart[c] + m_cellCount[c];
+  }
+  const uint32_t first = m_cellStart[begin];
+  const uint32_t available = m_cellStart[end] - first;
+  if (needed > available) {
+    return false;
+  }
+
+  std::vector<uint32_t> &scratch = m_cellBlocks[cellBlock].scratch;
+  scratch.clear();
+  for (size_t c = begin; c < end; ++c) {
+    scratch.insert(scratch.end(), m_sortedIndices.begin() + m_cellStart[c],
+                   m_sortedIndices.begin() + m_cellEnd[c]);
+  }
+  const uint64_t spare = available - needed;
+  const uint64_t cells = end - begin;
+  uint32_t offset = first;
+  uint32_t read = 0;
+  for (size_t c = begin; c < end; ++c) {
+    const uint32_t count = m_cellEnd[c] - m_cellStart[c];
+    std::copy(scratch.begin() + read, scratch.begin() + read + count,
+              m_sortedIndices.begin() + offset);
+    read += count;
+    m_cellStart[c] = offset;
+    m_cellEnd[c] = offset + count;
+    offset += count + m_cellCount[c] +
+              static_cast<uint32_t>(spare * (c - begin + 1) / cells -
+                                    spare * (c - begin) / cells);
+  }
+  return true;
+}
+
+// Each block's slice of the sorted populated list is filtered of the cells
+// that emptied and merged with the ones that filled, then the slices are
+// packed together again.
+void SpatialGrid::updatePopulatedCells(TaskScheduler &scheduler) {
+  m_nextBlockPopulated.assign(m_numCellBlocks + 1, 0);
+  scheduler.parallelFor(0, m_numCellBlocks, 1, [&](size_t start_idx,
+                                                  size_t end_idx) {
+    for (size_t b = start_idx; b < end_idx; ++b) {
+      CellBlock &block = m_cellBlocks[b];
+      if (!block.populatedChanged) {
+        m_nextBlockPopulated[b + 1] =
+            m_blockPopulated[b + 1] - m_blockPopulated[b];
+        continue;
+      }
+      std::sort(block.newCells.begin(), block.newCells.end());
+      block.populated.clear();
+      auto added = block.newCells.begin();
+      for (uint32_t k = m_blockPopulated[b]; k < m_blockPopulated[b + 1];
+           ++k) {
+        int cell = m_dirtyCellIndices[k];
+        if (!m_isCellDirty[cell]) {
+          continue;
+        }
+        while (added != block.newCells.end() && *added < cell) {
+          block.populated.push_back(*added++);
+        }
+        block.populated.push_back(cell);
+      }
+      block.populated.insert(block.populated.end(), added,
+                             block.newCells.end());
+      m_nextBlockPopulated[b + 1] =
+          static_cast<uint32_t>(block.populated.size());
+    }
+  });
+  for (size_t b = 0; b < m_numCellBlocks; ++b) {
+    m_nextBlockPopulated[b + 1] += m_nextBlockPopulated[b];
+  }
+
+  m_nextDirtyCellIndices.resize(m_nextBlockPopulated[m_numCellBlocks]);
+  scheduler.parallelFor(0, m_numCellBlocks, 1, [&](size_t start_idx,
+                                                  size_t end_idx) {
+    for (size_t b = start_idx; b < end_idx; ++b) {
+      auto out = m_nextDirtyCellIndices.begin() + m_nextBlockPopulated[b];
+      if (m_cellBlocks[b].populatedChanged) {
+        std::copy(m_cellBlocks[b].populated.begin(),
+                  m_cellBlocks[b].populated.end(), out);
+      } else {
+        std::copy(m_dirtyCellIndices.begin() + m_blockPopulated[b],
+                  m_dirtyCellIndices.begin() + m_blockPopulated[b + 1], out);
+      }
+    }
+  });
+  m_dirtyCellIndices.swap(m_nextDirtyCellIndices);
+  m_blockPopulated.swap(m_nextBlockPopulated);
+}
+
+bool SpatialGrid::hasAwakePairs(int cell, bool is3D) const {
+  if (isCellAwake(cell)) {
+    return true;
+  }
+  glm::ivec3 coords = getCellCoords(cell);
+  const int num_offsets = is3D ? 13 : 4;
+  for (int n = 0; n < num_offsets; ++n) {
+    glm::ivec3 neighborCoords = {coords.x + HALF_STENCIL[n][0],
+                                 coords.y + HALF_STENCIL[n][1],
+                                 coords.z + HALF_STENCIL[n][2]};
+    if (isValidCell(neighborCoords) &&
+        isCellAwake(get1DIndex(neighborCoords))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void SpatialGrid::buildColorBuckets(bool is3D) {
+  PROFILE_SCOPE("Color Buckets");
+  m_colorCells.resize(colorCount(is3D));
+  for (std::vector<int> &bucket : m_colorCells) {
+    bucket.clear();
+  }
+  for (int cell : m_dirtyCellIndices) {
+    glm::ivec3 coords = getCellCoords(cell);
+    int z = is3D ? coords.z : 0;
+    m_colorCells[(coords.x % 3) + 3 * (coords.y % 3) + 9 * (z % 3)]
+        .push_back(cell);
   }
-  m_dirtyCellIndices.clear();
 }
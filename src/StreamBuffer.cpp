@@ -0,0 +1,121 @@
+#include "../include/StreamBuffer.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+StreamBuffer::~StreamBuffer() { release(); }
+
+void StreamBuffer::release() {
+  for (GLsync &fence : m_fences) {
+    if (fence) {
+      glDeleteSync(fence);
+      fence = nullptr;
+    }
+  }
+  if (m_buffer) {
+    if (m_mapped) {
+      glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_buffer);
+      glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+      glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+    glDeleteBuffers(1, &m_buffer);
+  }
+  m_buffer = 0;
+  m_mapped = nullptr;
+  m_regionSize = 0;
+}
+
+// Regions start at multiples of the SSBO offset alignment and grow by half
+// again, so a slowly rising object count does not reallocate every frame.
+// The GPU keeps a deleted buffer alive until the commands using it finish.
+void StreamBuffer::allocate(size_t bytes) {
+  GLint alignment = 256;
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  size_t size = std::max({bytes, m_regionSize + m_regionSize / 2,
+                          static_cast<size_t>(alignment)});
+  size = (size + alignment - 1) / alignment * alignment;
+  release();
+
+  m_regionSize = size;
+  glGenBuffers(1, &m_buffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_buffer);
+  m_persistent = false;
+  if (GLEW_ARB_buffer_storage) {
+    const GLbitfield flags =
+        GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, size * REGIONS, nullptr, flags);
+    m_mapped = static_cast<char *>(glMapBufferRange(
+        GL_SHADER_STORAGE_BUFFER, 0, size * REGIONS, flags));
+    m_persistent = m_mapped != nullptr;
+    if (!m_persistent) {
+      // Immutable storage cannot be respecified, start over with a buffer
+      // for the mapping fallback.
+      std::cerr << "StreamBuffer: persistent mapping failed, falling back to "
+                   "per-frame mapping"
+                << std::endl;
+      glDeleteBuffers(1, &m_buffer);
+      glGenBuffers(1, &m_buffer);
+      glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_buffer);
+    }
+  }
+  if (!m_persistent) {
+    glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void *StreamBuffer::map(size_t bytes) {
+  if (!m_buffer || bytes > m_regionSize) {
+    allocate(bytes);
+  }
+  m_writeSize = bytes;
+
+  if (!m_persistent) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_buffer);
+    m_mapped = static_cast<char *>(
+        glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, m_regionSize,
+                         GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return m_mapped;
+  }
+
+  m_region = (m_region + 1) % REGIONS;
+  GLsync &fence = m_fences[m_region];
+  if (fence) {
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    while (status == GL_TIMEOUT_EXPIRED) {
+      status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+  }
+  return m_mapped + m_region * m_regionSize;
+}
+
+void StreamBuffer::commit(GLuint binding) {
+  GLintptr offset = 0;
+  if (!m_persistent) {
+    if (m_mapped) {
+      glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_buffer);
+      glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+      glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+      m_mapped = nullptr;
+    }
+  } else {
+    offset = static_cast<GLintptr>(m_region * m_regionSize);
+  }
+  // An empty range cannot be bound, so an empty write binds one element's
+  // worth of stale data that the shaders never index.
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, m_buffer, offset,
+                    std::max<size_t>(m_writeSize, 16));
+}
+
+void StreamBuffer::fence() {
+  if (!m_persistent || !m_buffer) {
+    return;
+  }
+  if (m_fences[m_region]) {
+    glDeleteSync(m_fences[m_region]);
+  }
+  m_fences[m_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -0,0 +1,197 @@
+#include "../include/TaskScheduler.hpp"
+#include "../include/Profiler.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <string>
+
+namespace {
+
+// Roughly 50-100 microseconds of spinning, which covers the gap between the
+// phases of one substep without burning a core while the app is idle.
+constexpr int SPIN_ITERATIONS = 4000;
+
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#else
+  std::this_thread::yield();
+#endif
+}
+
+inline uint64_t packRange(uint32_t start_idx, uint32_t end_idx) {
+  return (static_cast<uint64_t>(start_idx) << 32) | end_idx;
+}
+
+inline uint32_t rangeStart(uint64_t range) {
+  return static_cast<uint32_t>(range >> 32);
+}
+
+inline uint32_t rangeEnd(uint64_t range) {
+  return static_cast<uint32_t>(range);
+}
+
+} // namespace
+
+TaskScheduler::TaskScheduler(size_t threads) {
+  if (threads == 0) {
+    threads = 1;
+  }
+  m_numSlots = threads;
+  // Spinning only pays off when every worker has a core of its own; on an
+  // oversubscribed machine it steals time from the thread holding the work.
+  m_spinIterations =
+      threads <= std::thread::hardware_concurrency() ? SPIN_ITERATIONS : 0;
+  m_deques = std::make_unique<RangeDeque[]>(m_numSlots);
+  for (size_t slot = 1; slot < m_numSlots; ++slot) {
+    m_workers.emplace_back([this, slot] { workerLoop(slot); });
+  }
+}
+
+TaskScheduler::~TaskScheduler() {
+  m_stop.store(true, std::memory_order_release);
+  m_epoch.fetch_add(1, std::memory_order_release);
+  m_epoch.notify_all();
+  for (std::thread &worker : m_workers) {
+    worker.join();
+  }
+}
+
+void TaskScheduler::run(size_t begin, size_t end, size_t grain, Invoke invoke,
+                        const void *ctx) {
+  const size_t count = end - begin;
+  if (m_numSlots == 1 || count == 1) {
+    invoke(ctx, begin, end);
+    return;
+  }
+  if (count > std::numeric_limits<uint32_t>::max()) {
+    size_t middle = begin + count / 2;
+    run(begin, middle, grain, invoke, ctx);
+    run(middle, end, grain, invoke, ctx);
+    return;
+  }
+  if (grain == 0) {
+    grain = std::max<size_t>(1, count / (m_numSlots * 8));
+  }
+
+  Job job;
+  job.invoke = invoke;
+  job.ctx = ctx;
+  job.base = begin;
+  job.grain = static_cast<uint32_t>(std::min(grain, count));
+  job.pending.store(static_cast<uint32_t>(m_numSlots - 1),
+                    std::memory_order_relaxed);
+  for (size_t slot = 0; slot < m_numSlots; ++slot) {
+    uint32_t slot_start = static_cast<uint32_t>(slot * count / m_numSlots);
+    uint32_t slot_end = static_cast<uint32_t>((slot + 1) * count / m_numSlots);
+    m_deques[slot].range.store(packRange(slot_start, slot_end),
+                               std::memory_order_relaxed);
+  }
+  m_job = &job;
+  m_epoch.fetch_add(1, std::memory_order_release);
+  m_epoch.notify_all();
+
+  drain(job, 0);
+
+  int spins = 0;
+  uint32_t pending;
+  while ((pending = job.pending.load(std::memory_order_acquire)) != 0) {
+    if (++spins < m_spinIterations) {
+      cpuRelax();
+    } else {
+      job.pending.wait(pending, std::memory_order_acquire);
+    }
+  }
+  m_job = nullptr;
+}
+
+void TaskScheduler::workerLoop(size_t slot) {
+  Profiler::get().setThreadName("Worker " + std::to_string(slot));
+  uint32_t seen = 0;
+  for (;;) {
+    int spins = 0;
+    uint32_t epoch;
+    while ((epoch = m_epoch.load(std::memory_order_acquire)) == seen) {
+      if (++spins < m_spinIterations) {
+        cpuRelax();
+      } else {
+        m_epoch.wait(seen, std::memory_order_acquire);
+      }
+    }
+    seen = epoch;
+    if (m_stop.load(std::memory_order_acquire)) {
+      return;
+    }
+
+    Job &job = *m_job;
+    drain(job, slot);
+    if (job.pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      job.pending.notify_one();
+    }
+  }
+}
+
+void TaskScheduler::drain(Job &job, size_t slot) {
+  RangeDeque &own = m_deques[slot];
+  uint32_t start_idx;
+  uint32_t end_idx;
+  for (;;) {
+    while (popFront(own, job.grain, start_idx, end_idx)) {
+      job.invoke(job.ctx, job.base + start_idx, job.base + end_idx);
+    }
+
+    bool stole = false;
+    for (size_t k = 1; k < m_numSlots && !stole; ++k) {
+      RangeDeque &victim = m_deques[(slot + k) % m_numSlots];
+      stole = stealBack(victim, job.grain, start_idx, end_idx);
+    }
+    if (!stole) {
+      return;
+    }
+    // Our deque is empty here, so publishing the stolen range lets other
+    // idle workers split it further.
+    own.range.store(packRange(start_idx, end_idx), std::memory_order_release);
+  }
+}
+
+bool TaskScheduler::popFront(RangeDeque &deque, uint32_t grain,
+                             uint32_t &start_idx, uint32_t &end_idx) {
+  uint64_t range = deque.range.load(std::memory_order_acquire);
+  for (;;) {
+    uint32_t first = rangeStart(range);
+    uint32_t last = rangeEnd(range);
+    if (first >= last) {
+      return false;
+    }
+    uint32_t split = first + std::min(grain, last - first);
+    if (deque.range.compare_exchange_weak(range, packRange(split, last),
+                                          std::memory_order_acq_rel,
+                                          std::memory_order_acquire)) {
+      start_idx = first;
+      end_idx = split;
+      return true;
+    }
+  }
+}
+
+bool TaskScheduler::stealBack(RangeDeque &deque, uint32_t grain,
+                              uint32_t &start_idx, uint32_t &end_idx) {
+  uint64_t range = deque.range.load(std::memory_order_acquire);
+  for (;;) {
+    uint32_t first = rangeStart(range);
+    uint32_t last = rangeEnd(range);
+    if (first >= last) {
+      return false;
+    }
+    uint32_t remaining = last - first;
+    uint32_t take = remaining <= grain ? remaining : remaining / 2;
+    uint32_t split = last - take;
+    if (deque.range.compare_exchange_weak(range, packRange(first, split),
+                                          std::memory_order_acq_rel,
+                                          std::memory_order_acquire)) {
+      start_idx = split;
+      end_idx = last;
+      return true;
+    }
+  }
+}
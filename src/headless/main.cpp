@@ -0,0 +1,167 @@
+#include "../../include/NarrowPhase.hpp"
+#include "../../include/PhysicsWorld.hpp"
+#include "../../include/Profiler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+// Runs the physics core without a window or OpenGL context and reports the
+// sustained step rate, e.g. for profiling on a machine without a display.
+static void printUsage(const char *program) {
+  std::cerr
+      << "Usage: " << program << " [options]\n"
+      << "  --steps N           frames to simulate (default 1000)\n"
+      << "  --objects N         number of particles (default 4000)\n"
+      << "  --threads N         worker threads (default: all cores)\n"
+      << "  --seed N            random seed for the initial scene\n"
+      << "  --iterations N      physics substeps per frame (default 10)\n"
+      << "  --adaptive MIN,MAX  pick the substeps per frame from the speed\n"
+      << "  --2d                simulate a 2D layer instead of a 3D volume\n"
+      << "  --solver S          locked | colored\n"
+      << "  --broadphase B      object | cellpairs | list\n"
+      << "  --skin S            neighbour list skin (default 5)\n"
+      << "  --simd              use the batched narrow phase (cellpairs)\n"
+      << "  --incremental-grid  move only the objects that changed cell\n"
+      << "  --reorder K         Morton-sort the particles every K frames\n"
+      << "  --sleep             let objects at rest fall asleep\n"
+      << "  --trace FILE        record a Chrome trace of the run to FILE\n";
+}
+
+int main(int argc, char **argv) {
+  SimulationConstants constants;
+  int steps = 1000;
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  unsigned int seed = 1;
+  std::string trace_path;
+
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (std::strcmp(arg, "--help") == 0) {
+      printUsage(argv[0]);
+      return 0;
+    } else if (std::strcmp(arg, "--steps") == 0 && has_value) {
+      steps = std::atoi(argv[++i]);
+    } else if (std::strcmp(arg, "--objects") == 0 && has_value) {
+      constants.NUM_OBJECTS = std::atoi(argv[++i]);
+    } else if (std::strcmp(arg, "--threads") == 0 && has_value) {
+      threads = static_cast<size_t>(std::atoi(argv[++i]));
+    } else if (std::strcmp(arg, "--seed") == 0 && has_value) {
+      seed = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (std::strcmp(arg, "--iterations") == 0 && has_value) {
+      constants.PHYSICS_ITERATIONS = std::atoi(argv[++i]);
+    } else if (std::strcmp(arg, "--adaptive") == 0 && has_value) {
+      constants.ADAPTIVE_SUBSTEPS = true;
+      if (std::sscanf(argv[++i], "%d,%d", &constants.MIN_SUBSTEPS,
+                      &constants.MAX_SUBSTEPS) != 2) {
+        printUsage(argv[0]);
+        return 1;
+      }
+    } else if (std::strcmp(arg, "--2d") == 0) {
+      constants.USE_3D = false;
+    } else if (std::strcmp(arg, "--solver") == 0 && has_value) {
+      std::string solver = argv[++i];
+      if (solver == "locked") {
+        constants.CONTACT_SOLVER = ContactSolver::LOCKED;
+      } else if (solver == "colored") {
+        constants.CONTACT_SOLVER = ContactSolver::CELL_COLORED;
+      } else {
+        printUsage(argv[0]);
+        return 1;
+      }
+    } else if (std::strcmp(arg, "--broadphase") == 0 && has_value) {
+      std::string broadphase = argv[++i];
+      if (broadphase == "object") {
+        constants.BROADPHASE = Broadphase::OBJECT_NEIGHBOURHOOD;
+      } else if (broadphase == "cellpairs") {
+        constants.BROADPHASE = Broadphase::CELL_PAIRS;
+      } else if (broadphase == "list") {
+        constants.BROADPHASE = Broadphase::NEIGHBOUR_LIST;
+      } else {
+        printUsage(argv[0]);
+        return 1;
+      }
+    } else if (std::strcmp(arg, "--skin") == 0 && has_value) {
+      constants.NEIGHBOUR_SKIN = std::strtof(argv[++i], nullptr);
+    } else if (std::strcmp(arg, "--simd") == 0) {
+      constants.NARROW_PHASE = NarrowPhase::SIMD_BATCH;
+    } else if (std::strcmp(arg, "--incremental-grid") == 0) {
+      constants.INCREMENTAL_GRID = true;
+    } else if (std::strcmp(arg, "--reorder") == 0 && has_value) {
+      constants.MORTON_REORDER = true;
+      constants.REORDER_INTERVAL = std::atoi(argv[++i]);
+    } else if (std::strcmp(arg, "--sleep") == 0) {
+      constants.SLEEPING = true;
+    } else if (std::strcmp(arg, "--trace") == 0 && has_value) {
+      trace_path = argv[++i];
+    } else {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+  if (steps <= 0 || constants.NUM_OBJECTS < 0 || threads == 0 ||
+      constants.REORDER_INTERVAL <= 0) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  PhysicsWorld world(constants, threads);
+  world.restart(seed);
+  if (!trace_path.empty()) {
+    Profiler::get().setThreadName("Main");
+    Profiler::get().setEnabled(true);
+  }
+
+  uint64_t pair_tests = 0;
+  uint64_t substeps = 0;
+  uint64_t list_rebuilds = 0;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int step = 0; step < steps; ++step) {
+    Profiler::get().markFrame();
+    world.step();
+    pair_tests += world.stats().pairTests;
+    substeps += world.stats().substeps;
+    list_rebuilds += world.stats().listRebuilds;
+  }
+  float seconds = std::chrono::duration<float>(
+                      std::chrono::high_resolution_clock::now() - start)
+                      .count();
+
+  std::cout << "Objects:          " << world.objectCount() << " ("
+            << (constants.USE_3D ? "3D" : "2D") << ")\n"
+            << "Threads:          " << world.scheduler().getNumThreads()
+            << "\n"
+            << "Narrow Phase:     "
+            << (constants.NARROW_PHASE == NarrowPhase::SIMD_BATCH
+                    ? overlapKernelName()
+                    : "Scalar")
+            << "\n"
+            << "Steps:            " << steps << " in " << seconds << " s\n"
+            << "Steps / s:        " << steps / seconds << "\n"
+            << "ms / Step:        " << 1000.0f * seconds / steps << "\n"
+            << "Substeps / Step:  " << static_cast<float>(substeps) / steps
+            << "\n"
+            << "Pair Tests / Sub: " << pair_tests / steps << "\n"
+            << "Awake at End:     " << world.stats().awakeObjects << std::endl;
+  if (constants.BROADPHASE == Broadphase::NEIGHBOUR_LIST &&
+      world.stats().neighbourList) {
+    std::cout << "List Rebuilds:    " << list_rebuilds << " in " << substeps
+              << " substeps" << std::endl;
+  } else if (constants.BROADPHASE == Broadphase::NEIGHBOUR_LIST) {
+    std::cout << "List Rebuilds:    none, the cells leave no skin and cell "
+                 "pairs were used"
+              << std::endl;
+  }
+
+  if (!trace_path.empty() && !Profiler::get().writeChromeTrace(trace_path)) {
+    std::cerr << "Could not write " << trace_path << std::endl;
+    return 1;
+  }
+  return 0;
+}
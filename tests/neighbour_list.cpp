@@ -0,0 +1,127 @@
+#include "../include/NeighbourList.hpp"
+#include "../include/PhysicsWorld.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <utility>
+#include <vector>
+
+// Checks the neighbour list against a brute-force search over every pair,
+// with objects large enough for the skin to be clamped by the cell size.
+
+static int failures = 0;
+
+static void check(bool condition, const char *what) {
+  if (!condition) {
+    std::cerr << "FAILED: " << what << std::endl;
+    ++failures;
+  }
+}
+
+static SimulationConstants denseScene(float radius) {
+  SimulationConstants constants;
+  constants.USE_3D = true;
+  constants.WORLD_WIDTH = 600.0f;
+  constants.WORLD_HEIGHT = 600.0f;
+  constants.WORLD_DEPTH = 600.0f;
+  constants.CELL_SIZE_3D = 30.0f;
+  constants.NUM_OBJECTS = 4000;
+  constants.OBJECT_DEFAULT_RADIUS = radius;
+  constants.BROADPHASE = Broadphase::NEIGHBOUR_LIST;
+  constants.CONTACT_SOLVER = ContactSolver::CELL_COLORED;
+  constants.NEIGHBOUR_SKIN = 10.0f;
+  return constants;
+}
+
+static std::set<std::pair<uint32_t, uint32_t>>
+bruteForcePairs(const ParticleStore &particles, float skin) {
+  std::set<std::pair<uint32_t, uint32_t>> pairs;
+  for (uint32_t i = 0; i < particles.size(); ++i) {
+    for (uint32_t j = i + 1; j < particles.size(); ++j) {
+      const float reach = particles.radius[i] + particles.radius[j] + skin;
+      const float dx = particles.posX[i] - particles.posX[j];
+      const float dy = particles.posY[i] - particles.posY[j];
+      const float dz = particles.posZ[i] - particles.posZ[j];
+      if (dx * dx + dy * dy + dz * dz < reach * reach) {
+        pairs.insert({i, j});
+      }
+    }
+  }
+  return pairs;
+}
+
+static std::set<std::pair<uint32_t, uint32_t>>
+listPairs(const NeighbourList &list) {
+  std::set<std::pair<uint32_t, uint32_t>> pairs;
+  for (size_t cell = 0; cell < list.cellCount(); ++cell) {
+    for (const NeighbourPair &pair : list.cellPairs(cell)) {
+      pairs.insert({std::min(pair.i, pair.j), std::max(pair.i, pair.j)});
+    }
+  }
+  return pairs;
+}
+
+// Radius 12 in 30 unit cells leaves room for a skin of 6, not the 10 asked.
+static void clampedSkinMatchesBruteForce() {
+  SimulationConstants constants = denseScene(12.0f);
+  PhysicsWorld world(constants, 1);
+  world.restart(7);
+
+  const ParticleStore &particles = world.particles();
+  SpatialGrid grid(constants.WORLD_WIDTH, constants.WORLD_HEIGHT,
+                   constants.WORLD_DEPTH, constants.CELL_SIZE_3D);
+  TaskScheduler scheduler(1);
+  grid.rebuild(particles, true, scheduler);
+  NeighbourList list;
+  list.build(particles, grid, grid.populatedCells(), constants.NEIGHBOUR_SKIN,
+             true, scheduler);
+
+  check(list.skin() == 6.0f, "skin clamped to the cell size");
+  const auto expected = bruteForcePairs(particles, list.skin());
+  check(!expected.empty(), "scene has pairs within reach");
+  check(listPairs(list) == expected, "list pairs match brute force");
+}
+
+// Radius 20 fills the cells: no skin is left, so the list must not be used,
+// and stepping has to find the same contacts as cell pairs.
+static void fullCellsFallBackToCellPairs() {
+  SimulationConstants constants = denseScene(20.0f);
+  PhysicsWorld world(constants, 1);
+  world.restart(7);
+
+  check(NeighbourList::maxSkin(world.particles(), 30.0f) == 0.0f,
+        "no skin left in full cells");
+  check(!world.usesNeighbourList(), "full cells fall back to cell pairs");
+
+  SpatialGrid grid(constants.WORLD_WIDTH, constants.WORLD_HEIGHT,
+                   constants.WORLD_DEPTH, constants.CELL_SIZE_3D);
+  TaskScheduler scheduler(1);
+  grid.rebuild(world.particles(), true, scheduler);
+  NeighbourList list;
+  list.build(world.particles(), grid, grid.populatedCells(),
+             constants.NEIGHBOUR_SKIN, true, scheduler);
+  check(list.skin() == 0.0f, "skin clamped to zero, not below");
+
+  SimulationConstants cell_constants = constants;
+  cell_constants.BROADPHASE = Broadphase::CELL_PAIRS;
+  PhysicsWorld cell_world(cell_constants, 1);
+  cell_world.restart(7);
+  world.step();
+  cell_world.step();
+  check(world.stats().pairTests == cell_world.stats().pairTests,
+        "fallback tests the same pairs as cell pairs");
+  check(world.particles().posX == cell_world.particles().posX &&
+            world.particles().posY == cell_world.particles().posY &&
+            world.particles().posZ == cell_world.particles().posZ,
+        "fallback moves objects like cell pairs");
+}
+
+int main() {
+  clampedSkinMatchesBruteForce();
+  fullCellsFallBackToCellPairs();
+  if (failures == 0) {
+    std::cout << "All neighbour list checks passed" << std::endl;
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -7,24 +7,76 @@ set_symbols("debug")
 -- Ensure glew is present here
 add_requires("glfw", "opengl", "glm", "glew")
 
-add_includedirs("include", "external/imgui", "external/imgui/backends")
+-- Physics core without any window or OpenGL dependency, shared by the
+-- interactive engine and the headless runner
+target("PhysicsCore")
+    set_kind("static")
+    set_languages("c++20")
+
+    add_files("src/ParticleStore.cpp", "src/PhysicsObject.cpp",
+              "src/SpatialGrid.cpp", "src/NarrowPhase.cpp",
+              "src/NeighbourList.cpp", "src/MortonOrder.cpp",
+              "src/TaskScheduler.cpp", "src/PhysicsWorld.cpp",
+              "src/Profiler.cpp")
 
-add_files("src/*.cpp")
-add_files("external/imgui/*.cpp") 
-add_files("external/imgui/backends/imgui_impl_glfw.cpp")
-add_files("external/imgui/backends/imgui_impl_opengl3.cpp")
+    add_includedirs("include", {public = true})
+    add_packages("glm", {public = true})
+    add_syslinks("pthread", {public = true})
+
+    set_optimize("fastest")
 
 target("Physics_Engine")
     set_kind("binary")
     set_languages("c++20")
     set_targetdir("bin")
+    add_deps("PhysicsCore")
 
-    add_files("src/*.cpp", "glad-generated/src/glad.c", "external/imgui/*.cpp")
+    add_files("src/Camera.cpp", "src/GpuBvh.cpp", "src/GpuOverlapGrid.cpp",
+              "src/GpuPhysics.cpp", "src/GpuTimer.cpp", "src/GUI.cpp",
+              "src/ImpostorRenderer.cpp", "src/Shader.cpp",
+              "src/Simulation.cpp", "src/StreamBuffer.cpp", "src/Window.cpp",
+              "src/main.cpp")
+    add_files("glad-generated/src/glad.c", "external/imgui/*.cpp")
+    add_files("external/imgui/backends/imgui_impl_glfw.cpp")
+    add_files("external/imgui/backends/imgui_impl_opengl3.cpp")
 
-    add_includedirs("include", "external/imgui", "glad-generated/include") 
+    add_includedirs("include", "external/imgui", "external/imgui/backends",
+                    "glad-generated/include")
 
     -- Ensure glew is present here
     add_packages("opengl", "glfw", "glm", "glew")
 
     set_optimize("fastest")
     add_ldflags("-flto")
+
+target("Physics_Headless")
+    set_kind("binary")
+    set_languages("c++20")
+    set_targetdir("bin")
+    add_deps("PhysicsCore")
+
+    add_files("src/headless/main.cpp")
+
+    set_optimize("fastest")
+    add_ldflags("-flto")
+
+target("Physics_Bench")
+    set_kind("binary")
+    set_languages("c++20")
+    set_targetdir("bin")
+    add_deps("PhysicsCore")
+
+    add_files("bench/main.cpp")
+
+    set_optimize("fastest")
+    add_ldflags("-flto")
+
+-- Checks of the physics core, built only on request
+target("Physics_Tests")
+    set_kind("binary")
+    set_languages("c++20")
+    set_targetdir("bin")
+    set_default(false)
+    add_deps("PhysicsCore")
+
+    add_files("tests/neighbour_list.cpp")